@@ -0,0 +1,567 @@
+#include <string.h>
+#include <math.h>
+#include "apu.h"
+#include "ring.h"
+#include "cpu.h"
+#include "state.h"
+#include "gb.h"
+
+/* The channels only run when the cpu touches a sound register or a frame
+ * ends, as many cycles at a time as have gone by. Each change of a
+ * channel's level goes into buf as a band-limited step at the exact cycle
+ * it happened, and summing buf gives samples at APU_RATE.
+ */
+#define apu (gb_current->apu)
+
+#define BEFORE(a, b) ((int)((a) - (b)) < 0)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* 1/65536ths of a sample per cycle */
+#define APU_STEP (APU_RATE / 64)
+
+/* Most cycles that fit in half of buf */
+#define APU_CHUNK ((APU_BUF/2 - 1) * (4194304 / APU_RATE))
+
+#define APU_SEQ_CYCLES 8192
+#define APU_SCALE 32	/* Output per unit of a channel's level */
+
+/* Unused bits read back as 1 */
+static const unsigned char read_mask[0x30] = {
+	0x80, 0x3F, 0x00, 0xFF, 0xBF,
+	0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+	0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+	0xFF, 0xFF, 0x00, 0x00, 0xBF,
+	0x00, 0x00, 0x70,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+static const unsigned char duty[4] = {0x01, 0x81, 0x87, 0x7E};
+
+/* Channel i's NRi0-NRi4 */
+#define NR(i, n) (apu.regs[(i)*5 + (n)])
+
+static int apu_level(int i)
+{
+	struct apu_channel *ch = &apu.ch[i];
+	int sample, shift;
+
+	if(!ch->enabled)
+		return 0;
+
+	switch(i)
+	{
+		case 0:
+		case 1:
+			return (duty[NR(i, 1)>>6] >> ch->pos) & 1 ? ch->volume : 0;
+		case 2:
+			sample = apu.regs[0x20 + ch->pos/2];
+			sample = ch->pos & 1 ? sample & 0xF : sample >> 4;
+			shift = (NR(2, 2) >> 5) & 3;
+			return shift ? sample >> (shift - 1) : 0;
+		default:
+			return apu.lfsr & 1 ? 0 : ch->volume;
+	}
+}
+
+/* Put a step of d at cycle t into one side */
+static void apu_delta(int side, unsigned int t, int d)
+{
+	unsigned int pos = apu.buf_frac + (t - apu.buf_time) * APU_STEP;
+	int *k = apu.kernel[(pos >> 11) & 31];
+	int *b = &apu.buf[side][pos >> 16];
+	int i;
+
+	for(i = 0; i < APU_KERNEL; i++)
+		b[i] += d * k[i];
+}
+
+/* Channel i's level may have changed at cycle t */
+static void apu_update(int i, unsigned int t)
+{
+	struct apu_channel *ch = &apu.ch[i];
+	int level, left, right;
+
+	if(!apu.out)
+		return;
+
+	level = apu_level(i) * APU_SCALE;
+	left = apu.regs[0x15] & (0x10 << i) ? level * (((apu.regs[0x14] >> 4) & 7) + 1) : 0;
+	right = apu.regs[0x15] & (0x01 << i) ? level * ((apu.regs[0x14] & 7) + 1) : 0;
+
+	if(left != ch->left)
+		apu_delta(0, t, left - ch->left);
+	if(right != ch->right)
+		apu_delta(1, t, right - ch->right);
+
+	ch->left = left;
+	ch->right = right;
+}
+
+static void apu_run_channel(int i, unsigned int end)
+{
+	struct apu_channel *ch = &apu.ch[i];
+
+	if(!ch->enabled || !ch->period)
+		return;
+
+	/* Not run while there was no output */
+	if(BEFORE(ch->next, apu.time))
+		ch->next = apu.time;
+
+	while(BEFORE(ch->next, end))
+	{
+		if(i == 2)
+			ch->pos = (ch->pos + 1) & 31;
+		else if(i == 3)
+		{
+			unsigned int x = (apu.lfsr ^ (apu.lfsr >> 1)) & 1;
+
+			apu.lfsr = (apu.lfsr >> 1) | (x << 14);
+			if(NR(3, 3) & 0x08)
+				apu.lfsr = (apu.lfsr & ~0x40) | (x << 6);
+		}
+		else
+			ch->pos = (ch->pos + 1) & 7;
+
+		apu_update(i, ch->next);
+		ch->next += ch->period;
+	}
+}
+
+static unsigned int apu_period(int i)
+{
+	unsigned int freq = NR(i, 3) | (NR(i, 4) & 7) << 8;
+	unsigned int shift = NR(3, 3) >> 4, r = NR(3, 3) & 7;
+
+	switch(i)
+	{
+		case 0:
+		case 1:
+			return (2048 - freq) * 4;
+		case 2:
+			return (2048 - freq) * 2;
+		default:
+			return shift >= 14 ? 0 : (r ? r * 16 : 8) << shift;
+	}
+}
+
+static void apu_set_period(int i)
+{
+	struct apu_channel *ch = &apu.ch[i];
+	unsigned int old = ch->period;
+
+	ch->period = apu_period(i);
+	if(!old)
+		ch->next = apu.time + ch->period;
+}
+
+static void apu_disable(int i)
+{
+	apu.ch[i].enabled = 0;
+	apu_update(i, apu.time);
+}
+
+static unsigned int apu_sweep_calc(void)
+{
+	unsigned int d = apu.shadow >> (NR(0, 0) & 7);
+
+	return NR(0, 0) & 0x08 ? apu.shadow - d : apu.shadow + d;
+}
+
+static void apu_sweep(void)
+{
+	unsigned int period = (NR(0, 0) >> 4) & 7, f;
+
+	if(--apu.sweep_timer > 0)
+		return;
+	apu.sweep_timer = period ? period : 8;
+
+	if(!apu.sweep_enabled || !period)
+		return;
+
+	f = apu_sweep_calc();
+	if(f > 2047)
+	{
+		apu_disable(0);
+		return;
+	}
+
+	if(NR(0, 0) & 7)
+	{
+		apu.shadow = f;
+		NR(0, 3) = f & 0xFF;
+		NR(0, 4) = (NR(0, 4) & ~7) | f >> 8;
+		apu_set_period(0);
+
+		if(apu_sweep_calc() > 2047)
+			apu_disable(0);
+	}
+}
+
+static void apu_envelope(int i)
+{
+	struct apu_channel *ch = &apu.ch[i];
+	int period = NR(i, 2) & 7;
+
+	if(!period || --ch->env_timer > 0)
+		return;
+	ch->env_timer = period;
+
+	if(NR(i, 2) & 0x08 ? ch->volume < 15 : ch->volume > 0)
+	{
+		ch->volume += NR(i, 2) & 0x08 ? 1 : -1;
+		apu_update(i, apu.time);
+	}
+}
+
+/* Lengths on even steps, the sweep on 2 and 6, envelopes on 7 */
+static void apu_sequencer(void)
+{
+	int i;
+
+	if(!(apu.seq_step & 1))
+		for(i = 0; i < 4; i++)
+			if((NR(i, 4) & 0x40) && apu.ch[i].length && !--apu.ch[i].length)
+				apu_disable(i);
+
+	if(apu.seq_step == 2 || apu.seq_step == 6)
+		apu_sweep();
+
+	if(apu.seq_step == 7)
+	{
+		apu_envelope(0);
+		apu_envelope(1);
+		apu_envelope(3);
+	}
+
+	apu.seq_step = (apu.seq_step + 1) & 7;
+}
+
+/* Samples in buf that no later step can change */
+static unsigned int apu_pending(void)
+{
+	return (apu.buf_frac + (apu.time - apu.buf_time) * APU_STEP) >> 16;
+}
+
+/* Sum buf into samples for the ring, then start buf again from there.
+ * The sums leak a little each sample, which takes out any DC.
+ */
+static void apu_output(void)
+{
+	short samples[APU_BUF*2];
+	unsigned int pos = apu.buf_frac + (apu.time - apu.buf_time) * APU_STEP;
+	unsigned int n = pos >> 16, i;
+	int side;
+
+	for(side = 0; side < 2; side++)
+	{
+		int *b = apu.buf[side];
+
+		for(i = 0; i < n; i++)
+		{
+			int s;
+
+			apu.sum[side] += b[i];
+			s = apu.sum[side] >> 15;
+			samples[i*2 + side] = s > 32767 ? 32767 : s < -32768 ? -32768 : s;
+			apu.sum[side] -= apu.sum[side] >> 9;
+		}
+
+		memmove(b, &b[n], APU_KERNEL * sizeof *b);
+		memset(&b[APU_KERNEL], 0, n * sizeof *b);
+	}
+
+	ring_write(apu.out, samples, n*2);
+
+	apu.buf_frac = pos & 0xFFFF;
+	apu.buf_time = apu.time;
+}
+
+/* Run up to cycle t. Without an output only the frame sequencer runs,
+ * which is all that shows in the registers.
+ */
+static void apu_sync(unsigned int t)
+{
+	while(BEFORE(apu.time, t))
+	{
+		unsigned int end = t;
+		int i;
+
+		if(BEFORE(apu.seq_next, end))
+			end = apu.seq_next;
+		if(apu.out && end - apu.time > APU_CHUNK)
+			end = apu.time + APU_CHUNK;
+
+		if(apu.out && apu.power)
+			for(i = 0; i < 4; i++)
+				apu_run_channel(i, end);
+
+		apu.time = end;
+
+		if(apu.time == apu.seq_next)
+		{
+			if(apu.power)
+				apu_sequencer();
+			apu.seq_next += APU_SEQ_CYCLES;
+		}
+
+		if(apu.out && apu_pending() >= APU_BUF/2)
+			apu_output();
+	}
+}
+
+/* Start buf from nothing at the current time, as after a load */
+static void apu_resync(void)
+{
+	int i;
+
+	memset(apu.buf, 0, sizeof apu.buf);
+	apu.sum[0] = apu.sum[1] = 0;
+	apu.buf_time = apu.time;
+	apu.buf_frac = 0;
+
+	for(i = 0; i < 4; i++)
+	{
+		apu.ch[i].left = apu.ch[i].right = 0;
+		apu.ch[i].next = apu.time + apu.ch[i].period;
+		apu_update(i, apu.time);
+	}
+}
+
+static void apu_trigger(int i)
+{
+	struct apu_channel *ch = &apu.ch[i];
+
+	ch->enabled = ch->dac;
+	if(!ch->length)
+		ch->length = i == 2 ? 256 : 64;
+
+	ch->period = apu_period(i);
+	ch->next = apu.time + ch->period;
+	ch->pos = 0;
+
+	if(i != 2)
+	{
+		ch->volume = NR(i, 2) >> 4;
+		ch->env_timer = NR(i, 2) & 7;
+	}
+
+	if(i == 3)
+		apu.lfsr = 0x7FFF;
+
+	if(i == 0)
+	{
+		unsigned int period = (NR(0, 0) >> 4) & 7;
+
+		apu.shadow = NR(0, 3) | (NR(0, 4) & 7) << 8;
+		apu.sweep_timer = period ? period : 8;
+		apu.sweep_enabled = period || (NR(0, 0) & 7);
+		if((NR(0, 0) & 7) && apu_sweep_calc() > 2047)
+			ch->enabled = 0;
+	}
+}
+
+static void apu_power(int on)
+{
+	int i;
+
+	if(!on)
+	{
+		memset(apu.regs, 0, 0x16);
+		for(i = 0; i < 4; i++)
+		{
+			apu.ch[i].dac = 0;
+			apu_disable(i);
+		}
+	}
+	else if(!apu.power)
+		apu.seq_step = 0;
+
+	apu.power = on;
+}
+
+unsigned char apu_read(unsigned short addr)
+{
+	int r = addr - 0xFF10, i;
+	unsigned char v;
+
+	if(r >= 0x20)
+		return apu.regs[r];
+
+	apu_sync(cpu_get_cycles());
+
+	if(r != 0x16)
+		return apu.regs[r] | read_mask[r];
+
+	v = 0x70 | (apu.power ? 0x80 : 0);
+	for(i = 0; i < 4; i++)
+		if(apu.ch[i].enabled)
+			v |= 1 << i;
+
+	return v;
+}
+
+void apu_write(unsigned short addr, unsigned char v)
+{
+	int r = addr - 0xFF10, i;
+
+	apu_sync(cpu_get_cycles());
+
+	if(r >= 0x20)
+	{
+		apu.regs[r] = v;
+		if(apu.ch[2].enabled)
+			apu_update(2, apu.time);
+		return;
+	}
+
+	if(r == 0x16)
+	{
+		apu_power(v & 0x80);
+		return;
+	}
+
+	if(!apu.power || r > 0x16)
+		return;
+
+	apu.regs[r] = v;
+
+	/* Volumes and panning */
+	if(r >= 0x14)
+	{
+		for(i = 0; i < 4; i++)
+			apu_update(i, apu.time);
+		return;
+	}
+
+	i = r / 5;
+	switch(r % 5)
+	{
+		case 0:
+			if(i == 2)
+			{
+				apu.ch[2].dac = v & 0x80;
+				if(!apu.ch[2].dac)
+					apu.ch[2].enabled = 0;
+			}
+		break;
+		case 1:
+			apu.ch[i].length = i == 2 ? 256 - v : 64 - (v & 63);
+		break;
+		case 2:
+			if(i != 2)
+			{
+				apu.ch[i].dac = v & 0xF8;
+				if(!apu.ch[i].dac)
+					apu.ch[i].enabled = 0;
+			}
+		break;
+		case 3:
+			apu_set_period(i);
+		break;
+		case 4:
+			apu_set_period(i);
+			if(v & 0x80)
+				apu_trigger(i);
+		break;
+	}
+
+	apu_update(i, apu.time);
+}
+
+/* Catch up, and hand over everything up to now */
+void apu_end_frame(void)
+{
+	apu_sync(cpu_get_cycles());
+
+	if(apu.out)
+		apu_output();
+}
+
+void apu_set_output(struct ring *out)
+{
+	apu_sync(cpu_get_cycles());
+	apu.out = out;
+	apu_resync();
+}
+
+void apu_state(struct state *s)
+{
+	STATE_VAR(s, apu.regs);
+	STATE_VAR(s, apu.ch);
+	STATE_VAR(s, apu.power);
+	STATE_VAR(s, apu.time);
+	STATE_VAR(s, apu.seq_next);
+	STATE_VAR(s, apu.seq_step);
+	STATE_VAR(s, apu.sweep_enabled);
+	STATE_VAR(s, apu.sweep_timer);
+	STATE_VAR(s, apu.shadow);
+	STATE_VAR(s, apu.lfsr);
+
+	/* Whatever was waiting in buf is dropped */
+	if(s->loading)
+		apu_resync();
+}
+
+/* Windowed sinc steps for 32 positions between two samples, cut off a
+ * little under half the output rate. Each phase sums to exactly 1<<15 so
+ * summing buf gets back to the level it started from.
+ */
+static void apu_make_kernel(void)
+{
+	int p, i;
+
+	for(p = 0; p < 32; p++)
+	{
+		double h[APU_KERNEL], total = 0;
+		int sum = 0;
+
+		for(i = 0; i < APU_KERNEL; i++)
+		{
+			double x = i - (APU_KERNEL/2 - 1) - p / 32.0;
+			double y = M_PI * x * 0.9;
+
+			h[i] = y ? sin(y) / y : 1;
+			h[i] *= 0.42 + 0.5 * cos(M_PI * x / (APU_KERNEL/2)) + 0.08 * cos(2 * M_PI * x / (APU_KERNEL/2));
+			total += h[i];
+		}
+
+		for(i = 0; i < APU_KERNEL; i++)
+		{
+			apu.kernel[p][i] = floor(h[i] / total * (1<<15) + 0.5);
+			sum += apu.kernel[p][i];
+		}
+		apu.kernel[p][APU_KERNEL/2 - 1] += (1<<15) - sum;
+	}
+}
+
+/* As the boot ROM leaves it, channel 1 still on from the chime */
+void apu_init(void)
+{
+	static const unsigned char boot[0x17] = {
+		0x80, 0xBF, 0xF3, 0x00, 0xBF,
+		0x00, 0x3F, 0x00, 0x00, 0xBF,
+		0x7F, 0xFF, 0x9F, 0x00, 0xBF,
+		0x00, 0xFF, 0x00, 0x00, 0xBF,
+		0x77, 0xF3, 0xF1
+	};
+	int i;
+
+	memset(&apu, 0, sizeof apu);
+	memcpy(apu.regs, boot, sizeof boot);
+
+	apu.power = 1;
+	for(i = 0; i < 4; i++)
+		apu.ch[i].dac = i == 2 ? NR(2, 0) & 0x80 : NR(i, 2) & 0xF8;
+	apu.ch[0].enabled = 1;
+	apu.lfsr = 0x7FFF;
+
+	apu.time = cpu_get_cycles();
+	apu.seq_next = apu.time + APU_SEQ_CYCLES;
+
+	apu_make_kernel();
+	apu_resync();
+}
@@ -0,0 +1,16 @@
+#ifndef APU_H
+#define APU_H
+/* Output rate, a multiple of 64 so a cycle is a whole number of 1/65536
+ * samples
+ */
+#define APU_RATE 48000
+
+struct ring;
+void apu_init(void);
+void apu_set_output(struct ring *);
+void apu_end_frame(void);
+unsigned char apu_read(unsigned short);
+void apu_write(unsigned short, unsigned char);
+struct state;
+void apu_state(struct state *);
+#endif
@@ -0,0 +1,410 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "gb.h"
+#include "rom.h"
+#include "movie.h"
+
+/* Runs every line of a manifest as its own instance, spread over a pool
+ * of worker threads. Manifest lines are "rom input frames", with "-" for
+ * no input. Input scripts are input movies as recorded with --record.
+ * Every ROM and script is read once and shared by all the runs that use
+ * it.
+ *
+ * Given a directory instead, every .gb file under it is run as a test
+ * ROM until it reports a result or -f frames go by.
+ */
+struct rom_image {
+	struct rom_image *next;
+	char *path;
+	unsigned char *bytes;
+	unsigned int size;
+};
+
+struct input_script {
+	struct input_script *next;
+	char *path;
+	struct movie movie;
+};
+
+struct job {
+	struct rom_image *rom;
+	struct input_script *input;
+	unsigned int frames;
+	int test;	/* Stop at a pass or fail */
+
+	const char *status;
+	unsigned int frames_run, cycles;
+	unsigned long long hash;
+	unsigned int ms;
+};
+
+/* Each worker owns the jobs [top, bottom). It takes from the bottom,
+ * idle workers steal from the top.
+ */
+struct worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	unsigned int top, bottom;
+};
+
+static struct rom_image *roms;
+static struct input_script *scripts;
+static struct job *jobs;
+static unsigned int job_count;
+static struct worker *workers;
+static unsigned int worker_count;
+
+static struct rom_image *batch_get_rom(const char *path)
+{
+	struct rom_image *r;
+
+	for(r = roms; r; r = r->next)
+		if(!strcmp(r->path, path))
+			return r;
+
+	r = malloc(sizeof *r);
+	r->next = roms;
+	roms = r;
+	r->path = strdup(path);
+	r->bytes = rom_map(path, &r->size);
+	if(!r->bytes)
+		fprintf(stderr, "Couldn't load %s\n", path);
+
+	return r;
+}
+
+static struct input_script *batch_get_script(const char *path)
+{
+	struct input_script *s;
+
+	if(!strcmp(path, "-"))
+		return NULL;
+
+	for(s = scripts; s; s = s->next)
+		if(!strcmp(s->path, path))
+			return s;
+
+	s = malloc(sizeof *s);
+	s->next = scripts;
+	scripts = s;
+	s->path = strdup(path);
+
+	if(!movie_load(&s->movie, path))
+		fprintf(stderr, "Couldn't open input script %s\n", path);
+
+	return s;
+}
+
+static int batch_read_manifest(const char *path)
+{
+	char line[2048], rom[1024], input[1024];
+	unsigned int frames;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if(!f)
+		return 0;
+
+	while(fgets(line, sizeof line, f))
+	{
+		struct job *j;
+
+		if(sscanf(line, "%1023s %1023s %u", rom, input, &frames) != 3 || rom[0] == '#')
+			continue;
+
+		jobs = realloc(jobs, (job_count + 1) * sizeof *jobs);
+		j = &jobs[job_count++];
+		memset(j, 0, sizeof *j);
+		j->rom = batch_get_rom(rom);
+		j->input = batch_get_script(input);
+		j->frames = frames;
+	}
+
+	fclose(f);
+
+	return 1;
+}
+
+static int batch_find(const unsigned char *buf, unsigned int len, const char *s, unsigned int n)
+{
+	unsigned int i;
+
+	for(i = 0; i + n <= len; i++)
+		if(!memcmp(&buf[i], s, n))
+			return 1;
+
+	return 0;
+}
+
+/* How far a test ROM has got, by the conventions of the common suites:
+ * Blargg's print "Passed" or "Failed" over the link port, or put DE B0 61
+ * at A001 and a result in A000 that is 80 while running. Mooneye's load
+ * B-L with 3 5 8 13 21 34 for a pass and 42s for a fail, and send the
+ * same bytes over the link port. Returns "pass", "fail" or NULL.
+ */
+static const char *batch_test_result(gb_t *gb, int *running)
+{
+	static const char fib[] = {3, 5, 8, 13, 21, 34}, fail[] = {0x42, 0x42, 0x42, 0x42, 0x42, 0x42};
+	const unsigned char *out, *ram = gb->mbc.ram;
+	struct gb_cpu *c = &gb->cpu;
+	unsigned int len;
+
+	out = gb_get_serial(gb, &len);
+	if(batch_find(out, len, "Passed", 6) || batch_find(out, len, fib, 6))
+		return "pass";
+	if(batch_find(out, len, "Failed", 6) || batch_find(out, len, fail, 6))
+		return "fail";
+
+	if(c->B == 3 && c->C == 5 && c->D == 8 && c->E == 13 && c->H == 21 && c->L == 34)
+		return "pass";
+	if(c->B == 0x42 && c->C == 0x42 && c->D == 0x42 && c->E == 0x42 && c->H == 0x42 && c->L == 0x42)
+		return "fail";
+
+	/* Only trust A000 once it has said the test is running */
+	if(ram && ram[1] == 0xDE && ram[2] == 0xB0 && ram[3] == 0x61)
+	{
+		if(ram[0] == 0x80)
+			*running = 1;
+		else if(*running)
+			return ram[0] ? "fail" : "pass";
+	}
+
+	return NULL;
+}
+
+/* Nothing is drawn, the last frame's hash comes from the LCD's own */
+static void batch_run_job(struct job *j)
+{
+	struct timespec start, end;
+	struct movie input;
+	int running = 0;
+	gb_t *gb;
+
+	if(!j->rom->bytes || !(gb = gb_create_shared(j->rom->bytes, j->rom->size)))
+	{
+		j->status = "badrom";
+		return;
+	}
+
+	j->status = j->test ? NULL : "ok";
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Our own copy for the playback position, the events are shared */
+	if(j->input)
+		input = j->input->movie;
+	else
+		memset(&input, 0, sizeof input);
+
+	while(gb_get_frames(gb) < j->frames)
+	{
+		unsigned int buttons, directions;
+
+		movie_play(&input, gb_get_frames(gb), &buttons, &directions);
+		gb_set_input(gb, buttons, directions);
+
+		if(gb_run_frame(gb) == GB_ERROR)
+		{
+			j->status = "error";
+			break;
+		}
+
+		if(j->test && (j->status = batch_test_result(gb, &running)))
+			break;
+	}
+
+	if(j->test && !j->status)
+		j->status = "timeout";
+
+	j->frames_run = gb_get_frames(gb);
+	j->cycles = gb_get_cycles(gb);
+	j->hash = gb_get_frame_hash(gb);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	j->ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+
+	gb_destroy(gb);
+}
+
+/* Take our own next job, or steal one from another worker */
+static struct job *batch_next_job(unsigned int self)
+{
+	unsigned int i;
+
+	for(i = 0; i < worker_count; i++)
+	{
+		struct worker *w = &workers[(self + i) % worker_count];
+		struct job *j = NULL;
+
+		pthread_mutex_lock(&w->lock);
+		if(w->top < w->bottom)
+			j = i == 0 ? &jobs[--w->bottom] : &jobs[w->top++];
+		pthread_mutex_unlock(&w->lock);
+
+		if(j)
+			return j;
+	}
+
+	return NULL;
+}
+
+static void *batch_worker(void *arg)
+{
+	unsigned int self = (struct worker *)arg - workers;
+	struct job *j;
+
+	while((j = batch_next_job(self)))
+		batch_run_job(j);
+
+	return NULL;
+}
+
+static void batch_add_test(const char *path, unsigned int frames)
+{
+	struct job *j;
+
+	jobs = realloc(jobs, (job_count + 1) * sizeof *jobs);
+	j = &jobs[job_count++];
+	memset(j, 0, sizeof *j);
+	j->rom = batch_get_rom(path);
+	j->frames = frames;
+	j->test = 1;
+}
+
+/* Every .gb under 'path', subdirectories included */
+static void batch_read_dir(const char *path, unsigned int frames)
+{
+	char name[4096];
+	struct dirent *e;
+	struct stat st;
+	DIR *dir;
+
+	dir = opendir(path);
+	if(!dir)
+	{
+		fprintf(stderr, "Couldn't open %s\n", path);
+		return;
+	}
+
+	while((e = readdir(dir)))
+	{
+		size_t len = strlen(e->d_name);
+
+		if(e->d_name[0] == '.')
+			continue;
+
+		snprintf(name, sizeof name, "%s/%s", path, e->d_name);
+		if(stat(name, &st))
+			continue;
+
+		if(S_ISDIR(st.st_mode))
+			batch_read_dir(name, frames);
+		else if(len > 3 && !strcmp(&e->d_name[len-3], ".gb"))
+			batch_add_test(name, frames);
+	}
+
+	closedir(dir);
+}
+
+static int batch_compare_jobs(const void *a, const void *b)
+{
+	return strcmp(((const struct job *)a)->rom->path, ((const struct job *)b)->rom->path);
+}
+
+int main(int argc, char *argv[])
+{
+	const char usage[] = "Usage: %s [-j threads] [-o results] [-f test_frames] <manifest | test directory>\n";
+	const char *manifest = NULL, *output = NULL;
+	unsigned int i, test_frames = 7200, passed = 0;
+	int tests = 0;
+	FILE *out = stdout;
+	struct stat st;
+
+	worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for(i = 1; i < (unsigned int)argc; i++)
+	{
+		if(!strcmp(argv[i], "-j") && i+1 < (unsigned int)argc)
+			worker_count = strtoul(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "-o") && i+1 < (unsigned int)argc)
+			output = argv[++i];
+		else if(!strcmp(argv[i], "-f") && i+1 < (unsigned int)argc)
+			test_frames = strtoul(argv[++i], NULL, 0);
+		else if(!manifest && argv[i][0] != '-')
+			manifest = argv[i];
+		else
+			break;
+	}
+
+	if(!manifest || i != (unsigned int)argc || !worker_count)
+	{
+		fprintf(stderr, usage, argv[0]);
+		return 1;
+	}
+
+	if(!stat(manifest, &st) && S_ISDIR(st.st_mode))
+	{
+		tests = 1;
+		batch_read_dir(manifest, test_frames);
+		qsort(jobs, job_count, sizeof *jobs, batch_compare_jobs);
+	}
+	else if(!batch_read_manifest(manifest))
+	{
+		fprintf(stderr, "Couldn't read %s\n", manifest);
+		return 1;
+	}
+
+	if(output && !(out = fopen(output, "w")))
+	{
+		fprintf(stderr, "Couldn't write %s\n", output);
+		return 1;
+	}
+
+	if(worker_count > job_count)
+		worker_count = job_count ? job_count : 1;
+
+	workers = calloc(worker_count, sizeof *workers);
+	for(i = 0; i < worker_count; i++)
+	{
+		struct worker *w = &workers[i];
+
+		pthread_mutex_init(&w->lock, NULL);
+		w->top = job_count * i / worker_count;
+		w->bottom = job_count * (i+1) / worker_count;
+		pthread_create(&w->thread, NULL, batch_worker, w);
+	}
+
+	for(i = 0; i < worker_count; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	fprintf(out, "# rom input frames status frames_run cycles frame_hash ms\n");
+	for(i = 0; i < job_count; i++)
+	{
+		struct job *j = &jobs[i];
+
+		fprintf(out, "%s %s %u %s %u %u %016llx %u\n", j->rom->path,
+			j->input ? j->input->path : "-", j->frames, j->status,
+			j->frames_run, j->cycles, j->hash, j->ms);
+
+		if(!strcmp(j->status, "pass"))
+			passed++;
+	}
+
+	if(tests)
+		fprintf(out, "# %u of %u passed\n", passed, job_count);
+
+	if(out != stdout)
+		fclose(out);
+
+	for(; roms; roms = roms->next)
+		if(roms->bytes)
+			rom_unmap(roms->bytes, roms->size);
+
+	return tests && passed != job_count;
+}
@@ -0,0 +1,295 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "cpu.h"
+#include "mem.h"
+#include "interrupt.h"
+#include "sched.h"
+#include "state.h"
+#include "gb.h"
+
+/* Microbenchmark for the opcode dispatch in cpu.c. The cpu runs a tight
+ * ALU/CB/stack loop out of a flat 64KiB array, with the rest of the
+ * machine stubbed out, so the time measured is fetch, decode and execute.
+ *
+ * With --check it instead runs a pseudo-random stream of flag setting and
+ * flag reading ops, pushing AF only after runs of 1 to 16 of them so flags
+ * are mostly read straight from what the ops before left. It prints a
+ * checksum of the stack, registers and instruction count so builds with
+ * and without LAZY_FLAGS or JIT can be compared. The stream is run
+ * CHECK_PASSES times so its blocks get hot enough to be compiled.
+ *
+ * --check-smc runs smc_program[], which patches hot routines in WRAM,
+ * including one that overwrites its own next instruction, and fails
+ * unless every call saw the code as it was last written.
+ */
+#define CYCLES 200000000u
+
+static gb_t gb;
+__thread gb_t *gb_current = &gb;
+static unsigned char *const mem = gb.mem.ram;	/* cpu_write_code() stores there */
+
+static const unsigned char program[] = {
+	0x31, 0xFE, 0xFF,	/* LD SP, FFFE */
+	0x21, 0x00, 0xC0,	/* LD HL, C000 */
+	0x01, 0x00, 0x00,	/* LD BC, 0000 */
+	/* loop: */
+	0x04, 0x0D, 0x78,	/* INC B, DEC C, LD A, B */
+	0x81, 0x8A, 0x93, 0x9C,	/* ADD C, ADC D, SUB E, SBC H */
+	0xA5, 0xA8, 0xB1, 0xBA,	/* AND L, XOR B, OR C, CP D */
+	0x77, 0x5E, 0x7E,	/* LD (HL), A, LD E, (HL), LD A, (HL) */
+	0xCB, 0x00, 0xCB, 0x19,	/* RLC B, RR C */
+	0xCB, 0x32, 0xCB, 0x5B,	/* SWAP D, BIT 3, E */
+	0xCB, 0xCC, 0xCB, 0x8C,	/* SET 1, H, RES 1, H */
+	0xCB, 0x3F, 0xCB, 0x7E,	/* SRL A, BIT 7, (HL) */
+	0xC5, 0xD1,		/* PUSH BC, POP DE */
+	0xFE, 0x40,		/* CP 40 */
+	0x20, 0x01, 0x00,	/* JR NZ, +1, NOP */
+	0x18, 0xD7		/* JR loop */
+};
+
+/* Ops that set or read flags without jumping away or writing memory */
+static const unsigned char check_ops[] = {
+	0x03, 0x04, 0x05, 0x07, 0x09, 0x0B, 0x0C, 0x0D, 0x0F,
+	0x13, 0x14, 0x15, 0x17, 0x19, 0x1B, 0x1C, 0x1D, 0x1F,
+	0x23, 0x24, 0x25, 0x27, 0x29, 0x2B, 0x2C, 0x2D, 0x2F,
+	0x37, 0x39, 0x3C, 0x3D, 0x3F
+};
+
+static const unsigned char check_imm_ops[] = {
+	0x06, 0x0E, 0x16, 0x1E, 0x26, 0x2E, 0x3E,	/* LD r, imm8 */
+	0xC6, 0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE	/* ALU A, imm8 */
+};
+
+/* Two routines in WRAM, each run 16384 times. C100 stores A at HL, then
+ * loads the byte at C102. Every 1024th call HL is C102, so it rewrites
+ * its own next instruction, otherwise C1F0. C200 loads the byte at C201,
+ * which the caller sets before every call.
+ */
+static const unsigned char smc_program[] = {
+	0x31, 0xFE, 0xFF,	/* LD SP, FFFE */
+	0x0E, 0x40,		/* LD C, 40 */
+	0x16, 0x00,		/* LD D, 00 */
+	/* outer: */
+	0x1E, 0x00,		/* LD E, 00 */
+	/* inner: */
+	0x21, 0xF0, 0xC1,	/* LD HL, C1F0 */
+	0x7B, 0xB7,		/* LD A, E, OR A */
+	0x20, 0x08,		/* JR NZ, call */
+	0x79, 0xE6, 0x03,	/* LD A, C, AND 03 */
+	0x20, 0x03,		/* JR NZ, call */
+	0x2E, 0x02,		/* LD L, 02 */
+	0x51,			/* LD D, C */
+	/* call: */
+	0x79,			/* LD A, C */
+	0xCD, 0x00, 0xC1,	/* CALL C100 */
+	0xBA,			/* CP D */
+	0x20, 0x16,		/* JR NZ, fail */
+	0x7B,			/* LD A, E */
+	0xEA, 0x01, 0xC2,	/* LD (C201), A */
+	0xCD, 0x00, 0xC2,	/* CALL C200 */
+	0xBB,			/* CP E */
+	0x20, 0x0C,		/* JR NZ, fail */
+	0x1D, 0x20, 0xDD,	/* DEC E, JR NZ, inner */
+	0x0D, 0x20, 0xD8,	/* DEC C, JR NZ, outer */
+	0x3E, 0x01,		/* LD A, 01 */
+	0xEA, 0x00, 0xC0,	/* LD (C000), A */
+	0x76,			/* HALT */
+	/* fail: */
+	0x3E, 0xFF,		/* LD A, FF */
+	0xEA, 0x00, 0xC0,	/* LD (C000), A */
+	0x76			/* HALT */
+};
+
+static const unsigned char smc_routines[][4] = {
+	{0x77, 0x3E, 0x00, 0xC9},	/* LD (HL), A, LD A, 00, RET */
+	{0x3E, 0x00, 0xC9}		/* LD A, 00, RET */
+};
+
+#define CHECK_OPS 4000
+#define CHECK_PASSES 32
+#define CHECK_COUNT 0xC000
+
+unsigned char mem_get_byte(unsigned short i) { return mem[i]; }
+unsigned short mem_get_word(unsigned short i) { return mem[i] | mem[(unsigned short)(i+1)]<<8; }
+unsigned char mem_get_raw(unsigned short i) { return mem[i]; }
+
+/* Writes go through write_pages as in mem.c, so cpu.c sees its code rewritten */
+void mem_write_byte(unsigned short d, unsigned char i)
+{
+	void (*write)(unsigned short, unsigned char) = gb.mem.write_pages[d>>8];
+
+	if(write)
+		write(d, i);
+	else
+		mem[d] = i;
+}
+
+void mem_write_word(unsigned short d, unsigned short i) { mem_write_byte(d, i); mem_write_byte(d+1, i>>8); }
+
+void mem_set_write_pages(int first, int last, void (*write)(unsigned short, unsigned char))
+{
+	int i;
+
+	for(i = first; i <= last; i++)
+		gb.mem.write_pages[i] = write;
+}
+
+void interrupt_flush(void) {}
+void interrupt_enable(void) {}
+void interrupt_disable(void) {}
+int interrupt_get_enabled(void) { return 0; }
+int interrupt_pending(void) { return 0; }
+unsigned char interrupt_get_IF(void) { return 0; }
+unsigned char interrupt_get_mask(void) { return 0; }
+
+unsigned int sched_next(void) { return CYCLES; }
+void state_var(struct state *s, void *p, unsigned int n) { (void) s; (void) p; (void) n; }
+
+static unsigned int check_run(void)
+{
+	unsigned int seed = 1, hash = 2166136261u, i, n, r, run = 0;
+	unsigned short pc = 0x100;
+
+	mem[CHECK_COUNT] = CHECK_PASSES;
+
+	mem[pc++] = 0x31;	/* loop: LD SP, FFFE */
+	mem[pc++] = 0xFE;
+	mem[pc++] = 0xFF;
+
+	for(n = 0; n < CHECK_OPS; n++)
+	{
+		seed = seed * 1103515245 + 12345;
+		r = seed >> 8;
+
+		switch(r % 7)
+		{
+			case 0:
+				mem[pc++] = check_ops[(r>>4) % sizeof check_ops];
+			break;
+			case 1:
+				mem[pc++] = check_imm_ops[(r>>4) % sizeof check_imm_ops];
+				mem[pc++] = r >> 12;
+			break;
+			case 2:	/* CB op on any register but (HL) */
+				mem[pc++] = 0xCB;
+				mem[pc++] = ((r>>4) & 0xF8) | (((r>>12) % 7 + 7) % 8);
+			break;
+			case 3:	/* JR cc, +0 */
+				mem[pc++] = 0x20 | ((r>>4) & 0x18);
+				mem[pc++] = 0;
+			break;
+			case 4:	/* LD r, r' on any register but (HL) */
+				mem[pc++] = 0x40 | (((r>>4) % 7 + 7) % 8) << 3 | ((r>>8) % 7 + 7) % 8;
+			break;
+			case 5:	/* LD BC/DE/HL, imm16 */
+				mem[pc++] = 0x01 | ((r>>4) % 3) << 4;
+				mem[pc++] = r >> 8;
+				mem[pc++] = r >> 16;
+			break;
+			default:	/* 8-bit ALU, (HL) only reads */
+				mem[pc++] = 0x80 | ((r>>4) & 0x3F);
+			break;
+		}
+
+		if(!run--)
+		{
+			mem[pc++] = 0xF5;	/* PUSH AF */
+			run = r >> 20;
+		}
+	}
+
+	/* Push everything else too, then go round again until the count
+	 * runs out, keeping AF for the next pass
+	 */
+	mem[pc++] = 0xC5;
+	mem[pc++] = 0xD5;
+	mem[pc++] = 0xE5;
+	mem[pc++] = 0xF5;	/* PUSH AF */
+	mem[pc++] = 0xFA;	/* LD A, (CHECK_COUNT) */
+	mem[pc++] = CHECK_COUNT & 0xFF;
+	mem[pc++] = CHECK_COUNT >> 8;
+	mem[pc++] = 0x3D;	/* DEC A */
+	mem[pc++] = 0xEA;	/* LD (CHECK_COUNT), A */
+	mem[pc++] = CHECK_COUNT & 0xFF;
+	mem[pc++] = CHECK_COUNT >> 8;
+	mem[pc++] = 0x28;	/* JR Z, stop */
+	mem[pc++] = 0x04;
+	mem[pc++] = 0xF1;	/* POP AF */
+	mem[pc++] = 0xC3;	/* JP loop */
+	mem[pc++] = 0x00;
+	mem[pc++] = 0x01;
+	mem[pc++] = 0x76;	/* stop: HALT */
+
+	cpu_init();
+	cpu_run();
+
+	for(i = 0xC000; i < 0x10000; i++)
+		hash = (hash ^ mem[i]) * 16777619u;
+
+	hash = (hash ^ cpu_get_instructions()) * 16777619u;
+
+	return hash;
+}
+
+static int check_smc(void)
+{
+	memcpy(&mem[0x100], smc_program, sizeof smc_program);
+	memcpy(&mem[0xC100], smc_routines[0], sizeof smc_routines[0]);
+	memcpy(&mem[0xC200], smc_routines[1], sizeof smc_routines[1]);
+
+	cpu_init();
+	cpu_run();
+
+	return mem[0xC000] == 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec t1, t2;
+	double ns;
+	unsigned int instructions;
+	int i;
+
+	for(i = 0; i < 256; i++)
+		gb.mem.read_pages[i] = &mem[i*0x100];
+
+	if(argc > 1 && !strcmp(argv[1], "--check"))
+	{
+		printf("%08x\n", check_run());
+		return 0;
+	}
+
+	if(argc > 1 && !strcmp(argv[1], "--check-smc"))
+	{
+		if(check_smc())
+			return 0;
+		printf("Stale code ran after a write to WRAM\n");
+		return 1;
+	}
+
+	memcpy(&mem[0x100], program, sizeof program);
+	cpu_init();
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	cpu_run();
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	instructions = cpu_get_instructions();
+	ns = (t2.tv_sec - t1.tv_sec) * 1e9 + (t2.tv_nsec - t1.tv_nsec);
+
+#if defined(COMPUTED_GOTO)
+	printf("goto:   ");
+#elif defined(LAZY_FLAGS)
+	printf("lazy:   ");
+#elif defined(JIT)
+	printf("jit:    ");
+#else
+	printf("switch: ");
+#endif
+	printf("%u instructions, %.1f MIPS, %.2f ns/instruction\n",
+		instructions, instructions / ns * 1e3, ns / instructions);
+
+	return 0;
+}
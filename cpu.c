@@ -1,30 +1,120 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "cpu.h"
+#include "jit.h"
 #include "mem.h"
 #include "rom.h"
 #include "interrupt.h"
+#include "sched.h"
+#include "state.h"
+#include "gb.h"
+
+/* With -DLAZY_FLAGS the common ALU ops only record their operands and
+ * result, and F is worked out from them when something reads it.
+ */
+#ifdef LAZY_FLAGS
+#define get_F() (c.lazy ? cpu_eval_flags() : c.F)
+#define put_F(x) do { c.F = (x); c.lazy = 0; } while(0)
+#else
+#define get_F() c.F
+#define put_F(x) c.F = (x)
+#endif
 
 #define set_HL(x) do {unsigned int macro = (x); c.L = macro&0xFF; c.H = macro>>8;} while(0)
 #define set_BC(x) do {unsigned int macro = (x); c.C = macro&0xFF; c.B = macro>>8;} while(0)
 #define set_DE(x) do {unsigned int macro = (x); c.E = macro&0xFF; c.D = macro>>8;} while(0)
-#define set_AF(x) do {unsigned int macro = (x); c.F = macro&0xFF; c.A = macro>>8;} while(0)
+#define set_AF(x) do {unsigned int macro = (x); put_F(macro&0xFF); c.A = macro>>8;} while(0)
 
-#define get_AF() ((c.A<<8) | c.F)
+#define get_AF() ((c.A<<8) | get_F())
 #define get_BC() ((c.B<<8) | c.C)
 #define get_DE() ((c.D<<8) | c.E)
 #define get_HL() ((c.H<<8) | c.L)
 
 /* Flags */
-#define set_Z(x) c.F = ((c.F&0x7F) | ((x)<<7))
-#define set_N(x) c.F = ((c.F&0xBF) | ((x)<<6))
-#define set_H(x) c.F = ((c.F&0xDF) | ((x)<<5))
-#define set_C(x) c.F = ((c.F&0xEF) | ((x)<<4))
-
+#define set_Z(x) c.F = ((get_F()&0x7F) | ((x)<<7))
+#define set_N(x) c.F = ((get_F()&0xBF) | ((x)<<6))
+#define set_H(x) c.F = ((get_F()&0xDF) | ((x)<<5))
+#define set_C(x) c.F = ((get_F()&0xEF) | ((x)<<4))
+
+#ifdef LAZY_FLAGS
+#define flag_Z (c.lazy ? !c.lz_r : !!(c.F & 0x80))
+#define flag_C cpu_lazy_carry()
+#else
 #define flag_Z !!((c.F & 0x80))
-#define flag_N !!((c.F & 0x40))
-#define flag_H !!((c.F & 0x20))
 #define flag_C !!((c.F & 0x10))
+#endif
+#define flag_N !!((get_F() & 0x40))
+#define flag_H !!((get_F() & 0x20))
 
 /* Opcodes */
+#define LDRR(x, y) \
+	x = y; \
+	c.cycles += 1;
+
+#define LDRIMM8(x) \
+	x = IMM8; \
+	c.PC += 1; \
+	c.cycles += 2;
+
+#ifdef LAZY_FLAGS
+enum {
+	LAZY_ADD,
+	LAZY_SUB,
+	LAZY_AND,
+	LAZY_OR,
+	LAZY_INC,	/* lz_b holds the carry INC/DEC leave alone */
+	LAZY_DEC
+};
+
+#define LAZY_OP(op, a, b, r) \
+	c.lz_b = (b); \
+	c.lz_a = (a); \
+	c.lz_r = (r); \
+	c.lz_op = (op); \
+	c.lazy = 1;
+
+#define INC(x) \
+	x++; \
+	LAZY_OP(LAZY_INC, 0, flag_C, x) \
+	c.cycles += 1;
+
+#define DEC(x) \
+	x--; \
+	LAZY_OP(LAZY_DEC, 0, flag_C, x) \
+	c.cycles += 1;
+
+#define ANDR(x) \
+	c.A &= x; \
+	LAZY_OP(LAZY_AND, 0, 0, c.A) \
+	c.cycles += 1;
+
+#define XORR(x) \
+	c.A ^= x; \
+	LAZY_OP(LAZY_OR, 0, 0, c.A) \
+	c.cycles += 1;
+
+#define ORR(x) \
+	c.A |= x; \
+	LAZY_OP(LAZY_OR, 0, 0, c.A) \
+	c.cycles += 1;
+
+#define CPR(x) \
+	LAZY_OP(LAZY_SUB, c.A, x, c.A - x) \
+	c.cycles += 1;
+
+#define SUBR(x) \
+	LAZY_OP(LAZY_SUB, c.A, x, c.A - x) \
+	c.A = c.lz_r; \
+	c.cycles += 1;
+
+#define ADDR(x) \
+	LAZY_OP(LAZY_ADD, c.A, x, c.A + x) \
+	c.A = c.lz_r; \
+	c.cycles += 1;
+#else
 #define INC(x) \
 	x++; \
 	set_Z(!x); \
@@ -39,15 +129,6 @@
 	set_H((x & 0xF) == 0xF); \
 	c.cycles += 1;
 
-#define LDRR(x, y) \
-	x = y; \
-	c.cycles += 1;
-
-#define LDRIMM8(x) \
-	x = mem_get_byte(c.PC); \
-	c.PC += 1; \
-	c.cycles += 2;
-
 #define ANDR(x) \
 	c.A &= x; \
 	set_Z(!c.A); \
@@ -87,617 +168,216 @@
 	set_N(1); \
 	c.cycles += 1;
 
-struct CPU {
-	unsigned char H;
-	unsigned char L;
-
-	unsigned char D;
-	unsigned char E;
+#define ADDR(x) \
+	i = c.A + x; \
+	set_H((c.A&0xF)+(x&0xF) > 0xF); \
+	set_C(i > 0xFF); \
+	set_N(0); \
+	c.A = i; \
+	set_Z(!c.A); \
+	c.cycles += 1;
+#endif
 
-	unsigned char B;
-	unsigned char C;
+/* Opcode dispatch, either a plain switch or GCC's computed goto through
+ * a 256 entry label table. Build with -DCOMPUTED_GOTO for the latter.
+ */
+#ifdef COMPUTED_GOTO
+#define OP(n) op_##n
+#define OP_DEFAULT op_unhandled
+#define DISPATCH(b) goto *ops[b]
+#else
+#define OP(n) case n
+#define OP_DEFAULT default
+#define DISPATCH(b)
+#endif
 
-	unsigned char A;
-	unsigned char F;
+/* An op's immediate, already read when it was decoded */
+#define IMM8 ((unsigned char)op->imm)
+#define IMM16 (op->imm)
 
-	unsigned short SP;
-	unsigned short PC;
-	unsigned int cycles, prev_cycles;
-};
+#define c (gb_current->cpu)
 
-static struct CPU c;
+#ifdef EBUG
+static int is_debugged = 1;
+#else
 static int is_debugged;
-static int halted;
+#endif
 
-void cpu_init(void)
+/* Reads at PC, straight from the page when it's plain memory */
+static inline unsigned char cpu_fetch(unsigned short pc)
 {
-	set_AF(0x01B0);
-	set_BC(0x0013);
-	set_DE(0x00D8);
-	set_HL(0x014D);
-	c.SP = 0xFFFE;
-	c.PC = 0x0100;
-	c.cycles = 0;
-	c.prev_cycles = 0;
+	unsigned char *page = gb_current->mem.read_pages[pc>>8];
+
+	return page ? page[pc&0xFF] : mem_get_byte(pc);
 }
 
-static void RLC(unsigned char reg)
+#ifdef LAZY_FLAGS
+static unsigned char cpu_eval_flags(void)
 {
-	unsigned char t, old;
+	unsigned char a = c.lz_a, b = c.lz_b, r = c.lz_r, f = 0;
 
-	switch(reg)
+	switch(c.lz_op)
 	{
-		case 0:	/* B */
-			old = !!(c.B&0x80);
-			c.B = (c.B << 1) | old;
-			set_C(old);
-			set_Z(!c.B);
-		break;
-		case 1:	/* C */
-			old = !!(c.C&0x80);
-			set_C(old);
-			c.C = c.C<<1 | old;
-			set_Z(!c.C);
-		break;
-		case 2:	/* D */
-			old = !!(c.D&0x80);
-			set_C(old);
-			c.D = c.D<<1 | old;
-			set_Z(!c.D);
-		break;
-		case 3:	/* E */
-			old = !!(c.E&0x80);
-			set_C(old);
-			c.E = c.E<<1 | old;
-			set_Z(!c.E);
-		break;
-		case 4:	/* H */
-			old = !!(c.H&0x80);
-			set_C(old);
-			c.H = c.H<<1 | old;
-			set_Z(!c.H);
-		break;
-		case 5:	/* L */
-			old = !!(c.L&0x80);
-			set_C(old);
-			c.L = c.L<<1 | old;
-			set_Z(!c.L);
-		break;
-		case 6:	/* (HL) */
-			t = mem_get_byte(get_HL());
-			old = !!(t&0x80);
-			set_C(old);
-			t = t<<1 | old;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
+		case LAZY_ADD:
+			f = (!r)<<7 | ((a&0xF)+(b&0xF) > 0xF)<<5 | (a+b > 0xFF)<<4;
 		break;
-		case 7:	/* A */
-			old = !!(c.A&0x80);
-			c.A = (c.A<<1) | old;
-			set_C(old);
-			set_Z(!c.A);
+		case LAZY_SUB:
+			f = (!r)<<7 | 0x40 | ((a&0xF) < (b&0xF))<<5 | (a < b)<<4;
+		break;
+		case LAZY_AND:
+			f = (!r)<<7 | 0x20;
+		break;
+		case LAZY_OR:
+			f = (!r)<<7;
+		break;
+		case LAZY_INC:
+			f = (!r)<<7 | ((r&0xF) == 0)<<5 | b<<4;
+		break;
+		case LAZY_DEC:
+			f = (!r)<<7 | 0x40 | ((r&0xF) == 0xF)<<5 | b<<4;
 		break;
 	}
 
-	set_N(0);
-	set_H(0);
+	c.F = f;
+	c.lazy = 0;
+
+	return f;
 }
 
-static void RRC(unsigned char reg)
+/* Conditional jumps only need C, so don't work out the rest */
+static unsigned char cpu_lazy_carry(void)
 {
-	unsigned char t, old;
+	if(!c.lazy)
+		return !!(c.F & 0x10);
 
-	switch(reg)
+	switch(c.lz_op)
 	{
-		case 0:	/* B */
-			old = c.B&1;
-			set_C(old);
-			c.B = c.B>>1 | old<<7;
-			set_Z(!c.B);
-		break;
-		case 1:	/* C */
-			old = c.C&1;
-			set_C(old);
-			c.C = c.C>>1 | old<<7;
-			set_Z(!c.C);
-		break;
-		case 2:	/* D */
-			old = c.D&1;
-			set_C(old);
-			c.D = c.D>>1 | old<<7;
-			set_Z(!c.D);
-		break;
-		case 3:	/* E */
-			old = c.E&1;
-			set_C(old);
-			c.E = c.E>>1 | old<<7;
-			set_Z(!c.E);
-		break;
-		case 4:	/* H */
-			old = c.H&1;
-			set_C(old);
-			c.H = c.H>>1 | old<<7;
-			set_Z(!c.H);
-		break;
-		case 5:	/* L */
-			old = c.L&1;
-			set_C(old);
-			c.L = c.L>>1 | old<<7;
-			set_Z(!c.L);
-		break;
-		case 6:	/* (HL) */
-			t = mem_get_byte(get_HL());
-			old = t;
-			set_C(old);
-			t = t>>1 | old<<7;
-			c.cycles += 2;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-		break;
-		case 7:	/* A */
-			old = c.A&1;
-			set_C(old);
-			c.A = c.A>>1 | old<<7;
-			set_Z(!c.A);
-		break;
+		case LAZY_ADD:
+			return c.lz_a + c.lz_b > 0xFF;
+		case LAZY_SUB:
+			return c.lz_a < c.lz_b;
+		case LAZY_INC:
+		case LAZY_DEC:
+			return c.lz_b;
 	}
 
-	set_N(0);
-	set_H(0);
+	return 0;
 }
+#endif
 
-static void RL(unsigned char reg)
+/* CB-prefixed operations work on a pointer to their operand, the register
+ * (or a copy of (HL)) is picked by its cb_ops[] entry.
+ */
+static void RLC(unsigned char *r, unsigned char bit)
 {
-	unsigned char t, t2;
-
-	switch(reg)
-	{
-		case 0: /* B */
-			t2 = flag_C;
-			set_C(!!(c.B&0x80));
-			c.B = (c.B << 1) | !!(t2);
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			t2 = flag_C;
-			set_C(!!(c.C&0x80));
-			c.C = (c.C << 1) | !!(t2);
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			t2 = flag_C;
-			set_C(!!(c.D&0x80));
-			c.D = (c.D << 1) | !!(t2);
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			t2 = flag_C;
-			set_C(!!(c.E&0x80));
-			c.E = (c.E << 1) | !!(t2);
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			t2 = flag_C;
-			set_C(!!(c.H&0x80));
-			c.H = (c.H << 1) | !!(t2);
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			t2 = flag_C;
-			set_C(!!(c.L&0x80));
-			c.L = (c.L << 1) | !!(t2);
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t2 = flag_C;
-			set_C(!!(t&0x80));
-			t = (t << 1) | !!(t2);
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			t2 = flag_C;
-			set_C(!!(c.A&0x80));
-			c.A = (c.A << 1) | t2;
-			set_Z(!c.A);
-		break;
-	}
+	unsigned char old = !!(*r&0x80);
 
+	(void) bit;
+	*r = (*r<<1) | old;
+	set_C(old);
+	set_Z(!*r);
 	set_N(0);
 	set_H(0);
 }
 
-static void RR(unsigned char reg)
+static void RRC(unsigned char *r, unsigned char bit)
 {
-	unsigned char t, t2;
+	unsigned char old = *r&1;
 
-	switch(reg)
-	{
-		case 0:	/* B */
-			t2 = flag_C;
-			set_C(c.B&1);
-			c.B = (c.B >> 1) | t2<<7;
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			t2 = flag_C;
-			set_C(c.C&1);
-			c.C = (c.C >> 1) | t2<<7;
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			t2 = flag_C;
-			set_C(c.D&1);
-			c.D = (c.D >> 1) | t2<<7;
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			t2 = flag_C;
-			set_C(c.E&1);
-			c.E = (c.E >> 1) | t2<<7;
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			t2 = flag_C;
-			set_C(c.H&1);
-			c.H = (c.H >> 1) | t2<<7;
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			t2 = flag_C;
-			set_C(c.L&1);
-			c.L = (c.L >> 1) | t2<<7;
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t2 = flag_C;
-			set_C(t&1);
-			t = (t >> 1) | t2<<7;
-			set_Z(!t);
-			mem_write_byte(get_HL(), t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			t2 = flag_C;
-			set_C(c.A&1);
-			c.A = (c.A >> 1) | (t2<<7);
-			set_Z(!c.A);
-		break;
-	}
+	(void) bit;
+	set_C(old);
+	*r = *r>>1 | old<<7;
+	set_Z(!*r);
 	set_N(0);
 	set_H(0);
 }
 
-static void SLA(unsigned char reg)
+static void RL(unsigned char *r, unsigned char bit)
 {
-	unsigned char t;
-
-	switch(reg)
-	{
-		case 0: /* B */
-			set_C(!!(c.B & 0x80));
-			c.B = c.B << 1;
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			set_C(!!(c.C & 0x80));
-			c.C = c.C << 1;
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			set_C(!!(c.D & 0x80));
-			c.D = c.D << 1;
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			set_C(!!(c.E & 0x80));
-			c.E = c.E << 1;
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			set_C(!!(c.H & 0x80));
-			c.H = c.H << 1;
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			set_C(!!(c.L & 0x80));
-			c.L = c.L << 1;
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			set_C(!!(t & 0x80));
-			t = t << 1;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			set_C(!!(c.A & 0x80));
-			c.A = c.A << 1;
-			set_Z(!c.A);
-		break;
-	}
+	unsigned char t2 = flag_C;
 
-	set_H(0);
+	(void) bit;
+	set_C(!!(*r&0x80));
+	*r = (*r << 1) | t2;
+	set_Z(!*r);
 	set_N(0);
+	set_H(0);
 }
 
-static void SRA(unsigned char reg)
+static void RR(unsigned char *r, unsigned char bit)
 {
-	unsigned char old, t;
+	unsigned char t2 = flag_C;
 
-	switch(reg)
-	{
-		case 0: /* B */
-			set_C(c.B&1);
-			old = c.B&0x80;
-			c.B = c.B >> 1 | old;
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			set_C(c.C&1);
-			old = c.C&0x80;
-			c.C = c.C >> 1 | old;
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			set_C(c.D&1);
-			old = c.D&0x80;
-			c.D = c.D >> 1 | old;
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			set_C(c.E&1);
-			old = c.E&0x80;
-			c.E = c.E >> 1 | old;
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			set_C(c.H&1);
-			old = c.H&0x80;
-			c.H = c.H >> 1 | old;
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			set_C(c.L&1);
-			old = c.L&0x80;
-			c.L = c.L >> 1 | old;
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			set_C(t&1);
-			old = t&0x80;
-			t = t >> 1 | old;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-		break;
-		case 7: /* A */
-			set_C(c.A&1);
-			old = c.A&0x80;
-			c.A = c.A >> 1 | old;
-			set_Z(!c.A);
-		break;
-	}
+	(void) bit;
+	set_C(*r&1);
+	*r = (*r >> 1) | t2<<7;
+	set_Z(!*r);
+	set_N(0);
+	set_H(0);
+}
 
+static void SLA(unsigned char *r, unsigned char bit)
+{
+	(void) bit;
+	set_C(!!(*r & 0x80));
+	*r = *r << 1;
+	set_Z(!*r);
 	set_H(0);
 	set_N(0);
 }
 
-static void SRL(unsigned char reg)
+static void SRA(unsigned char *r, unsigned char bit)
 {
-	unsigned char t;
-
-	switch(reg)
-	{
-		case 0: /* B */
-			set_C(c.B & 1);
-			c.B = c.B >> 1;
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			set_C(c.C & 1);
-			c.C = c.C >> 1;
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			set_C(c.D & 1);
-			c.D = c.D >> 1;
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			set_C(c.E & 1);
-			c.E = c.E >> 1;
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			set_C(c.H & 1);
-			c.H = c.H >> 1;
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			set_C(c.L & 1);
-			c.L = c.L >> 1;
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			set_C(t & 1);
-			t = t >> 1;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			set_C(c.A & 1);
-			c.A = c.A >> 1;
-			set_Z(!c.A);
-		break;
-	}
-
+	(void) bit;
+	set_C(*r&1);
+	*r = *r >> 1 | (*r&0x80);
+	set_Z(!*r);
 	set_H(0);
 	set_N(0);
 }
 
-static void SWAP(unsigned char reg)
+static void SWAP(unsigned char *r, unsigned char bit)
 {
-	unsigned char t;
-
-	switch(reg)
-	{
-		case 0: /* B */
-			c.B = ((c.B&0xF)<<4) | ((c.B&0xF0)>>4);
-			c.F = (!c.B)<<7;
-		break;
-		case 1: /* C */
-			c.C = ((c.C&0xF)<<4) | ((c.C&0xF0)>>4);
-			c.F = (!c.C)<<7;
-		break;
-		case 2: /* D */
-			c.D = ((c.D&0xF)<<4) | ((c.D&0xF0)>>4);
-			c.F = (!c.D)<<7;
-		break;
-		case 3: /* E */
-			c.E = ((c.E&0xF)<<4) | ((c.E&0xF0)>>4);
-			c.F = (!c.E)<<7;
-		break;
-		case 4: /* H */
-			c.H = ((c.H&0xF)<<4) | ((c.H&0xF0)>>4);
-			c.F = (!c.H)<<7;
-		break;
-		case 5: /* L */
-			c.L = ((c.L&0xF)<<4) | ((c.L&0xF0)>>4);
-			c.F = (!c.L)<<7;
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t = ((t&0xF)<<4) | ((t&0xF0)>>4);
-			mem_write_byte(get_HL(), t);
-			c.F = (!t)<<7;
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			c.A = ((c.A&0xF)<<4) | ((c.A&0xF0)>>4);
-			c.F = (!c.A)<<7;
-		break;
-	}
+	(void) bit;
+	*r = ((*r&0xF)<<4) | ((*r&0xF0)>>4);
+	put_F((!*r)<<7);
 }
 
-static void BIT(unsigned char bit, unsigned char reg)
+static void SRL(unsigned char *r, unsigned char bit)
 {
-	unsigned char t, f = 0 /* Make GCC happy */;
-
-	switch(reg)
-	{
-		case 0: /* B */
-		    f = !(c.B & bit);
-		break;
-		case 1: /* C */
-		    f = !(c.C & bit);
-		break;
-		case 2: /* D */
-		    f = !(c.D & bit);
-		break;
-		case 3: /* E */
-		    f = !(c.E & bit);
-		break;
-		case 4: /* H */
-		    f = !(c.H & bit);
-		break;
-		case 5: /* L */
-		    f = !(c.L & bit);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			f = !(t & bit);
-			c.cycles += 1;
-		break;
-		case 7: /* A */
-		    f = !(c.A & bit);
-		break;
-	}
+	(void) bit;
+	set_C(*r & 1);
+	*r = *r >> 1;
+	set_Z(!*r);
+	set_H(0);
+	set_N(0);
+}
 
-	set_Z(f);
+static void BIT(unsigned char *r, unsigned char bit)
+{
+	set_Z(!(*r & bit));
 	set_N(0);
 	set_H(1);
 }
 
-static void RES(unsigned char bit, unsigned char reg)
+static void RES(unsigned char *r, unsigned char bit)
 {
-	unsigned char t;
-
-	switch(reg)
-	{
-		case 0: /* B */
-			c.B &= ~bit;
-		break;
-		case 1: /* C */
-			c.C &= ~bit;
-		break;
-		case 2: /* D */
-			c.D &= ~bit;
-		break;
-		case 3: /* E */
-			c.E &= ~bit;
-		break;
-		case 4: /* H */
-			c.H &= ~bit;
-		break;
-		case 5: /* L */
-			c.L &= ~bit;
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t &= ~bit;
-			mem_write_byte(get_HL(), t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			c.A &= ~bit;
-		break;
-	}
+	*r &= ~bit;
 }
 
-static void SET(unsigned char bit, unsigned char reg)
+static void SET(unsigned char *r, unsigned char bit)
 {
-	unsigned char t;
-
-	switch(reg)
-	{
-		case 0: /* B */
-			c.B |= bit;
-		break;
-		case 1: /* C */
-			c.C |= bit;
-		break;
-		case 2: /* D */
-			c.D |= bit;
-		break;
-		case 3: /* E */
-			c.E |= bit;
-		break;
-		case 4: /* H */
-			c.H |= bit;
-		break;
-		case 5: /* L */
-			c.L |= bit;
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t |= bit;
-			mem_write_byte(get_HL(), t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			c.A |= bit;
-		break;
-	}
+	*r |= bit;
 }
 
+struct cb_op {
+	void (*f)(unsigned char *, unsigned char);
+	signed char reg;	/* Offset into struct gb_cpu, -1 for (HL) */
+	unsigned char bit;
+	unsigned char cycles;	/* Extra cycles taken by the (HL) form */
+	unsigned char write;	/* The (HL) form writes its result back */
+};
+
 /*
 00000xxx = RLC xxx
 00001xxx = RRC xxx
@@ -710,29 +390,305 @@ static void SET(unsigned char bit, unsigned char reg)
 01yyyxxx = BIT yyy, xxx
 10yyyxxx = RES yyy, xxx
 11yyyxxx = SET yyy, xxx
+
+Constant, so instances on other threads can share it without building it.
 */
+#define CB_REG(r) offsetof(struct gb_cpu, r)
+#define CB_ROW(f, bit, cycles, write) \
+	{f, CB_REG(B), bit, cycles, write}, {f, CB_REG(C), bit, cycles, write}, \
+	{f, CB_REG(D), bit, cycles, write}, {f, CB_REG(E), bit, cycles, write}, \
+	{f, CB_REG(H), bit, cycles, write}, {f, CB_REG(L), bit, cycles, write}, \
+	{f, -1, bit, cycles, write},        {f, CB_REG(A), bit, cycles, write}
+#define CB_BITS(f, cycles, write) \
+	CB_ROW(f, 0x01, cycles, write), CB_ROW(f, 0x02, cycles, write), \
+	CB_ROW(f, 0x04, cycles, write), CB_ROW(f, 0x08, cycles, write), \
+	CB_ROW(f, 0x10, cycles, write), CB_ROW(f, 0x20, cycles, write), \
+	CB_ROW(f, 0x40, cycles, write), CB_ROW(f, 0x80, cycles, write)
+
+static const struct cb_op cb_ops[256] = {
+	CB_ROW(RLC, 0x01, 0, 1),
+	CB_ROW(RRC, 0x02, 2, 1),
+	CB_ROW(RL, 0x04, 2, 1),
+	CB_ROW(RR, 0x08, 2, 1),
+	CB_ROW(SLA, 0x10, 2, 1),
+	CB_ROW(SRA, 0x20, 0, 1),
+	CB_ROW(SWAP, 0x40, 2, 1),
+	CB_ROW(SRL, 0x80, 2, 1),
+	CB_BITS(BIT, 1, 0),
+	CB_BITS(RES, 2, 1),
+	CB_BITS(SET, 2, 1)
+};
+
 static void decode_CB(unsigned char t)
 {
-	unsigned char reg, opcode, bit;
-	void (*f[])(unsigned char) = {RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL};
-	void (*f2[])(unsigned char, unsigned char) = {BIT, RES, SET};
+	const struct cb_op *op = &cb_ops[t];
+	unsigned char v;
+
+	if(op->reg >= 0)
+	{
+		op->f((unsigned char *)&c + op->reg, op->bit);
+		return;
+	}
+
+	v = mem_get_byte(get_HL());
+	op->f(&v, op->bit);
+	if(op->write)
+		mem_write_byte(get_HL(), v);
+	c.cycles += op->cycles;
+}
+
+/* Decoded code. A block is the run of ops from some address up to a jump,
+ * call, return, HALT, EI or DI, or the end of its 256 byte page, with the
+ * immediates already read. Blocks are keyed by where the code actually
+ * lives rather than by PC, so each ROM bank has its own and a bank switch
+ * just picks different blocks. ROM blocks never go stale; blocks in RAM
+ * are all dropped as soon as a page with code in it is written.
+ */
+#define BLOCKS 4096
+#define BLOCK_OPS 16
+#define REWRITE_COOLDOWN 70224	/* About a frame */
+#define JIT_HOT 16		/* Runs before a block is handed to the JIT */
+
+struct cpu_block {
+	const unsigned char *code;	/* First opcode, NULL if empty */
+	const unsigned char *page;	/* read_pages[] entry it was decoded from */
+	unsigned int gen;		/* cache->gen it was decoded in, 0 for ROM */
+	unsigned int count;
+	struct cpu_op ops[BLOCK_OPS];
+#ifdef JIT
+	jit_code native;
+	unsigned int runs;
+#endif
+};
+
+/* Kept outside the instance, so snapshots don't copy it */
+struct cpu_cache {
+	unsigned int gen;
+	unsigned int watched;			/* Entries in pages[] */
+	unsigned char pages[0x80];		/* RAM pages given cpu_write_code() */
+	unsigned char code[0x8000/8];		/* Which bytes of 8000-FFFF are in blocks */
+	unsigned int rewritten[0x80];		/* When each RAM page last had code written over, 0 if not lately */
+#ifdef JIT
+	struct jit *jit;			/* NULL if there's no executable memory */
+	unsigned int next;			/* sched_next() as JIT code sees it */
+#endif
+	struct cpu_block blocks[BLOCKS];
+};
+
+static const unsigned char op_len[256] = {
+	1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,	/* 0x */
+	1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,	/* 1x */
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,	/* 2x */
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,	/* 3x */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 4x */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 5x */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 6x */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 7x */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 8x */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 9x */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* Ax */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* Bx */
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,	/* Cx */
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,	/* Dx */
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,	/* Ex */
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1	/* Fx */
+};
+
+#define M OP_MEM
+#define E OP_END
+static const unsigned char op_flags[256] = {
+	0, 0, M, 0, 0, 0, 0, 0, M, 0, M, 0, 0, 0, 0, 0,	/* 0x */
+	E, 0, M, 0, 0, 0, 0, 0, E, 0, M, 0, 0, 0, 0, 0,	/* 1x */
+	E, 0, M, 0, 0, 0, 0, 0, E, 0, M, 0, 0, 0, 0, 0,	/* 2x */
+	E, 0, M, 0, M, M, M, 0, E, 0, M, 0, 0, 0, 0, 0,	/* 3x */
+	0, 0, 0, 0, 0, 0, M, 0, 0, 0, 0, 0, 0, 0, M, 0,	/* 4x */
+	0, 0, 0, 0, 0, 0, M, 0, 0, 0, 0, 0, 0, 0, M, 0,	/* 5x */
+	0, 0, 0, 0, 0, 0, M, 0, 0, 0, 0, 0, 0, 0, M, 0,	/* 6x */
+	M, M, M, M, M, M, E, M, 0, 0, 0, 0, 0, 0, M, 0,	/* 7x */
+	0, 0, 0, 0, 0, 0, M, 0, 0, 0, 0, 0, 0, 0, M, 0,	/* 8x */
+	0, 0, 0, 0, 0, 0, M, 0, 0, 0, 0, 0, 0, 0, M, 0,	/* 9x */
+	0, 0, 0, 0, 0, 0, M, 0, 0, 0, 0, 0, 0, 0, M, 0,	/* Ax */
+	0, 0, 0, 0, 0, 0, M, 0, 0, 0, 0, 0, 0, 0, M, 0,	/* Bx */
+	E, M, E, E, E, M, 0, E, E, E, E, 0, E, E, 0, E,	/* Cx */
+	E, M, E, E, E, M, 0, E, E, E, E, E, E, E, 0, E,	/* Dx */
+	M, M, M, E, E, M, 0, E, 0, E, M, E, E, E, 0, E,	/* Ex */
+	M, M, M, E, E, M, 0, E, 0, 0, M, E, E, E, 0, E	/* Fx */
+};
+#undef M
+#undef E
+
+static void cpu_write_code(unsigned short, unsigned char);
+
+static struct cpu_block *cpu_decode_block(struct cpu_block *blk, const unsigned char *page)
+{
+	unsigned int off = c.PC & 0xFF, n = 0, len, i;
+	struct cpu_op *op;
+
+	/* RAM can only be watched where writes go straight to it */
+	if(c.PC >= 0x8000)
+	{
+		void (*write)(unsigned short, unsigned char) = gb_current->mem.write_pages[c.PC>>8];
+
+		if(write && write != cpu_write_code)
+			return NULL;
+
+		/* Code that rewrites itself would only be decoded again and
+		 * again, leave it to cpu_cycle() for a while
+		 */
+		i = c.cache->rewritten[(c.PC>>8) - 0x80];
+		if(i && c.cycles - i < REWRITE_COOLDOWN)
+			return NULL;
+		c.cache->rewritten[(c.PC>>8) - 0x80] = 0;
+
+		if(!write)
+		{
+			mem_set_write_pages(c.PC>>8, c.PC>>8, cpu_write_code);
+			c.cache->pages[c.cache->watched++] = c.PC>>8;
+		}
+	}
+
+	while(n < BLOCK_OPS)
+	{
+		len = op_len[page[off]];
+		if(off + len > 0x100)
+			break;
+
+		op = &blk->ops[n++];
+		op->opcode = page[off];
+		op->flags = op_flags[op->opcode];
+		op->imm = len == 3 ? page[off+1] | page[off+2]<<8 : len == 2 ? page[off+1] : 0;
+		if(op->opcode == 0xCB && cb_ops[op->imm].reg < 0)
+			op->flags |= OP_MEM;
+
+		off += len;
+		if(op->flags & OP_END)
+			break;
+	}
+
+	if(!n)
+		return NULL;
+
+	blk->code = &page[c.PC & 0xFF];
+	blk->page = page;
+	blk->gen = c.PC >= 0x8000 ? c.cache->gen : 0;
+	blk->count = n;
+#ifdef JIT
+	blk->native = NULL;
+	blk->runs = 0;
+#endif
+
+	if(blk->gen)
+		for(i = c.PC - 0x8000; i < (c.PC & 0xFF00) + off - 0x8000; i++)
+			c.cache->code[i>>3] |= 1<<(i&7);
+
+	return blk;
+}
+
+/* The block at PC, decoding it if need be. NULL where PC has to go
+ * through mem_get_byte(), or is in RAM that writes can't be watched in.
+ */
+static struct cpu_block *cpu_get_block(void)
+{
+	const unsigned char *page = gb_current->mem.read_pages[c.PC>>8], *code;
+	struct cpu_block *blk;
+
+	if(!page || !c.cache)
+		return NULL;
+
+	code = &page[c.PC & 0xFF];
+	blk = &c.cache->blocks[((uintptr_t)code ^ (uintptr_t)code>>14) & (BLOCKS-1)];
+
+	if(blk->code == code && (!blk->gen || blk->gen == c.cache->gen))
+		return blk;
+
+	return cpu_decode_block(blk, page);
+}
+
+/* Forget every block decoded out of RAM, and stop watching its pages */
+static void cpu_drop_ram(void)
+{
+	unsigned int i, p;
+
+	if(!++c.cache->gen)
+		c.cache->gen = 1;
 
-	reg = t&7;
-	opcode = t>>3;
-	if(opcode < 8)
+	for(i = 0; i < c.cache->watched; i++)
 	{
-		f[opcode](reg);
+		p = c.cache->pages[i];
+		mem_set_write_pages(p, p, NULL);
+		memset(&c.cache->code[(p - 0x80)*0x100/8], 0, 0x100/8);
+	}
+	c.cache->watched = 0;
+}
+
+/* The same, for when RAM and write_pages[] have been replaced wholesale and
+ * the watched pages aren't known any more
+ */
+void cpu_invalidate_ram(void)
+{
+	int p;
+
+	if(!c.cache)
 		return;
+
+	for(p = 0x80; p < 0x100; p++)
+		if(gb_current->mem.write_pages[p] == cpu_write_code)
+			mem_set_write_pages(p, p, NULL);
+
+	c.cache->watched = 0;
+	memset(c.cache->code, 0, sizeof c.cache->code);
+	cpu_drop_ram();
+}
+
+/* Installed on RAM pages that blocks were decoded from. Only a write over
+ * decoded code drops anything, data sharing the page is left alone.
+ */
+static void cpu_write_code(unsigned short d, unsigned char i)
+{
+	gb_current->mem.ram[d] = i;
+
+	d -= 0x8000;
+	if(c.cache->code[d>>3] & 1<<(d&7))
+	{
+		c.cache->rewritten[d>>8] = c.cycles | 1;
+		cpu_drop_ram();
 	}
+}
 
-	bit = opcode&7;
-	opcode >>= 3;
-	f2[opcode-1](1<<bit, reg);
+void cpu_init(void)
+{
+	set_AF(0x01B0);
+	set_BC(0x0013);
+	set_DE(0x00D8);
+	set_HL(0x014D);
+	c.SP = 0xFFFE;
+	c.PC = 0x0100;
+	c.cycles = 0;
+	c.prev_cycles = 0;
+
+	/* Without a cache everything just runs through cpu_cycle() */
+	if(!c.cache && (c.cache = calloc(1, sizeof *c.cache)))
+	{
+		c.cache->gen = 1;
+#ifdef JIT
+		c.cache->jit = jit_create(&c.cache->next);
+#endif
+	}
+}
+
+void cpu_unload(void)
+{
+#ifdef JIT
+	if(c.cache)
+		jit_destroy(c.cache->jit);
+#endif
+	free(c.cache);
+	c.cache = NULL;
 }
 
 int cpu_halted(void)
 {
-	return halted;
+	return c.halted;
 }
 
 unsigned int cpu_get_cycles(void)
@@ -740,16 +696,19 @@ unsigned int cpu_get_cycles(void)
 	return c.prev_cycles;
 }
 
-static int halt_bug = 0;
+unsigned int cpu_get_instructions(void)
+{
+	return c.instructions;
+}
 
 void cpu_unhalt(void)
 {
-	halted = 0;
+	c.halted = 0;
 }
 
 void cpu_halt(void)
 {
-	halted = 1;
+	c.halted = 1;
 }
 
 unsigned int cpu_getpc(void)
@@ -759,7 +718,7 @@ unsigned int cpu_getpc(void)
 
 void cpu_interrupt_begin(void)
 {
-	halted = 0;
+	c.halted = 0;
 
 	c.SP -= 2;
 	mem_write_word(c.SP, c.PC);
@@ -771,90 +730,125 @@ void cpu_interrupt(unsigned short n)
 	interrupt_disable();
 }
 
+/* F goes in worked out, so states don't depend on LAZY_FLAGS */
+void cpu_state(struct state *s)
+{
+	c.F = get_F();
+
+	STATE_VAR(s, c.A);
+	STATE_VAR(s, c.F);
+	STATE_VAR(s, c.B);
+	STATE_VAR(s, c.C);
+	STATE_VAR(s, c.D);
+	STATE_VAR(s, c.E);
+	STATE_VAR(s, c.H);
+	STATE_VAR(s, c.L);
+	STATE_VAR(s, c.SP);
+	STATE_VAR(s, c.PC);
+	STATE_VAR(s, c.cycles);
+	STATE_VAR(s, c.prev_cycles);
+	STATE_VAR(s, c.halted);
+	STATE_VAR(s, c.halt_bug);
+
+	put_F(c.F);
+
+	if(s->loading)
+		cpu_invalidate_ram();
+}
+
 void cpu_print_debug(void)
 {
 	printf("%04X: %02X (%02X %02X)\n", c.PC, mem_get_byte(c.PC), mem_get_raw(0x40), mem_get_raw(0x41));
 	printf("\tAF: %02X%02X, BC: %02X%02X, DE: %02X%02X, HL: %02X%02X SP: %04X, cycles %d\n",
-		c.A, c.F, c.B, c.C, c.D, c.E, c.H, c.L, c.SP, c.cycles);
-	printf("Halted: %d, IME: %d, IF: %X, Mask: %X\n", halted, interrupt_get_enabled(), interrupt_get_IF(), interrupt_get_mask());
+		c.A, get_F(), c.B, c.C, c.D, c.E, c.H, c.L, c.SP, c.cycles);
+	printf("Halted: %d, IME: %d, IF: %X, Mask: %X\n", c.halted, interrupt_get_enabled(), interrupt_get_IF(), interrupt_get_mask());
 }
 
-int cpu_cycle(void)
+/* Runs one decoded op, PC already past its opcode */
+static int cpu_execute(const struct cpu_op *op)
 {
 	unsigned char b, t;
 	unsigned short s;
 	unsigned int i;
-
-	if(c.prev_cycles < c.cycles)
-	{
-		c.prev_cycles++;
-		return 1;
-	}
-
-	/* If any interrupts are pending, do them now */
-	interrupt_flush();
-
-	/* If the cpu is halted, do nothing instead */
-	if(halted)
-	{
-		c.cycles += 1;
-		return 1;
-	}
-
-#ifdef EBUG
-	is_debugged = 1;
+#ifdef COMPUTED_GOTO
+	static void *const ops[256] = {
+		&&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+		&&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+		&&op_unhandled, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+		&&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+		&&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+		&&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+		&&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+		&&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+		&&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+		&&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+		&&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+		&&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+		&&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+		&&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+		&&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+		&&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+		&&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+		&&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+		&&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+		&&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+		&&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+		&&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+		&&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+		&&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+		&&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+		&&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+		&&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_unhandled, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+		&&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_unhandled, &&op_0xDC, &&op_unhandled, &&op_0xDE, &&op_0xDF,
+		&&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_unhandled, &&op_unhandled, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+		&&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_unhandled, &&op_unhandled, &&op_unhandled, &&op_0xEE, &&op_0xEF,
+		&&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_unhandled, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+		&&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_unhandled, &&op_unhandled, &&op_0xFE, &&op_0xFF
+	};
 #endif
 
-	if(is_debugged)
-		cpu_print_debug();
-
-	/* Otherwise, execute as normal */
-	b = mem_get_byte(c.PC);
-
-	if(halt_bug)
-		halt_bug = 0;
-	else
-		c.PC++;
+	b = op->opcode;
 
+	DISPATCH(b);
 	switch(b)
 	{
-		case 0x00:	/* NOP */
+		OP(0x00):	/* NOP */
 			c.cycles += 1;
 		break;
-		case 0x01:	/* LD BC, imm16 */
-			s = mem_get_word(c.PC);
+		OP(0x01):	/* LD BC, imm16 */
+			s = IMM16;
 			set_BC(s);
 			c.PC += 2;
 			c.cycles += 3;
 		break;
-		case 0x02:	/* LD (BC), A */
+		OP(0x02):	/* LD (BC), A */
 			mem_write_byte(get_BC(), c.A);
 			c.cycles += 2;
 		break;
-		case 0x03:	/* INC BC */
+		OP(0x03):	/* INC BC */
 			set_BC(get_BC()+1);
 			c.cycles += 2;
 		break;
-		case 0x04:	/* INC B */
+		OP(0x04):	/* INC B */
 			INC(c.B);
 		break;
-		case 0x05:	/* DEC B */
+		OP(0x05):	/* DEC B */
 			DEC(c.B);
 		break;
-		case 0x06:	/* LD B, imm8 */
+		OP(0x06):	/* LD B, imm8 */
 			LDRIMM8(c.B);
 		break;
-		case 0x07:	/* RLCA */
-			RLC(7);
+		OP(0x07):	/* RLCA */
+			RLC(&c.A, 0);
 			set_Z(0);
 			c.cycles += 1;
 		break;
-		case 0x08:	/* LD (imm16), SP */
-			mem_write_word(mem_get_word(c.PC), c.SP);
+		OP(0x08):	/* LD (imm16), SP */
+			mem_write_word(IMM16, c.SP);
 			c.PC += 2;
 			c.cycles += 5;
 		break;
-		case 0x09:	/* ADD HL, BC */
+		OP(0x09):	/* ADD HL, BC */
 			i = get_HL() + get_BC();
 			set_N(0);
 			set_C(i >= 0x10000);
@@ -862,65 +856,65 @@ int cpu_cycle(void)
 			set_HL(i&0xFFFF);
 			c.cycles += 2;
 		break;
-		case 0x0A:	/* LD A, (BC) */
+		OP(0x0A):	/* LD A, (BC) */
 			c.A = mem_get_byte(get_BC());
 			c.cycles += 2;
 		break;
-		case 0x0B:	/* DEC BC */
+		OP(0x0B):	/* DEC BC */
 			s = get_BC();
 			s--;
 			set_BC(s);
 			c.cycles += 2;
 		break;
-		case 0x0C:	/* INC C */
+		OP(0x0C):	/* INC C */
 			INC(c.C);
 		break;
-		case 0x0D:	/* DEC C */
+		OP(0x0D):	/* DEC C */
 			DEC(c.C);
 		break;
-		case 0x0E:	/* LD C, imm8 */
+		OP(0x0E):	/* LD C, imm8 */
 			LDRIMM8(c.C);
 		break;
-		case 0x0F:	/* RRCA */
-			RRC(7);
+		OP(0x0F):	/* RRCA */
+			RRC(&c.A, 0);
 			set_Z(0);
 			c.cycles += 1;
 		break;
-		case 0x11:	/* LD DE, imm16 */
-			s = mem_get_word(c.PC);
+		OP(0x11):	/* LD DE, imm16 */
+			s = IMM16;
 			set_DE(s);
 			c.PC += 2;
 			c.cycles += 3;
 		break;
-		case 0x12:	/* LD (DE), A */
+		OP(0x12):	/* LD (DE), A */
 			mem_write_byte(get_DE(), c.A);
 			c.cycles += 2;
 		break;
-		case 0x13:	/* INC DE */
+		OP(0x13):	/* INC DE */
 			s = get_DE();
 			s++;
 			set_DE(s);
 			c.cycles += 2;
 		break;
-		case 0x14:	/* INC D */
+		OP(0x14):	/* INC D */
 			INC(c.D);
 		break;
-		case 0x15:	/* DEC D */
+		OP(0x15):	/* DEC D */
 			DEC(c.D);
 		break;
-		case 0x16:	/* LD D, imm8 */
+		OP(0x16):	/* LD D, imm8 */
 			LDRIMM8(c.D);
 		break;
-		case 0x17:	/* RLA */
-			RL(7);
+		OP(0x17):	/* RLA */
+			RL(&c.A, 0);
 			set_Z(0);
 			c.cycles += 1;
 		break;
-		case 0x18:	/* JR rel8 */
-			c.PC += (signed char)mem_get_byte(c.PC) + 1;
+		OP(0x18):	/* JR rel8 */
+			c.PC += (signed char)IMM8 + 1;
 			c.cycles += 3;
 		break;
-		case 0x19:	/* ADD HL, DE */
+		OP(0x19):	/* ADD HL, DE */
 			i = get_HL() + get_DE();
 			set_H((i&0xFFF) < (get_HL()&0xFFF));
 			set_HL(i);
@@ -928,69 +922,69 @@ int cpu_cycle(void)
 			set_C(i > 0xFFFF);
 			c.cycles += 2;
 		break;
-		case 0x1A:	/* LD A, (DE) */
+		OP(0x1A):	/* LD A, (DE) */
 			c.A = mem_get_byte(get_DE());
 			c.cycles += 2;
 		break;
-		case 0x1B:	/* DEC DE */
+		OP(0x1B):	/* DEC DE */
 			s = get_DE();
 			s--;
 			set_DE(s);
 			c.cycles += 2;
 		break;
-		case 0x1C:	/* INC E */
+		OP(0x1C):	/* INC E */
 			INC(c.E);
 		break;
-		case 0x1D:	/* DEC E */
+		OP(0x1D):	/* DEC E */
 			DEC(c.E);
 		break;
-		case 0x1E:	/* LD E, imm8 */
+		OP(0x1E):	/* LD E, imm8 */
 			LDRIMM8(c.E);
 		break;
-		case 0x1F:	/* RR A */
-			RR(7);
+		OP(0x1F):	/* RR A */
+			RR(&c.A, 0);
 			set_Z(0);
 			c.cycles += 1;
 		break;
-		case 0x20:	/* JR NZ, rel8 */
+		OP(0x20):	/* JR NZ, rel8 */
 			if(flag_Z == 0)
 			{
-				c.PC += (signed char)mem_get_byte(c.PC) + 1;
+				c.PC += (signed char)IMM8 + 1;
 				c.cycles += 3;
 			} else {
 				c.PC += 1;
 				c.cycles += 2;
 			}
 		break;
-		case 0x21:	/* LD HL, imm16 */
-			s = mem_get_word(c.PC);
+		OP(0x21):	/* LD HL, imm16 */
+			s = IMM16;
 			set_HL(s);
 			c.PC += 2;
 			c.cycles += 3;
 		break;
-		case 0x22:	/* LDI (HL), A */
+		OP(0x22):	/* LDI (HL), A */
 			i = get_HL();
 			mem_write_byte(i, c.A);
 			i++;
 			set_HL(i);
 			c.cycles += 2;
 		break;
-		case 0x23:	/* INC HL */
+		OP(0x23):	/* INC HL */
 			s = get_HL();
 			s++;
 			set_HL(s);
 			c.cycles += 2;
 		break;
-		case 0x24:	/* INC H */
+		OP(0x24):	/* INC H */
 			INC(c.H);
 		break;
-		case 0x25:	/* DEC H */
+		OP(0x25):	/* DEC H */
 			DEC(c.H);
 		break;
-		case 0x26:	/* LD H, imm8 */
+		OP(0x26):	/* LD H, imm8 */
 			LDRIMM8(c.H);
 		break;
-		case 0x27:	/* DAA */
+		OP(0x27):	/* DAA */
 			s = c.A;
 
 			if(flag_N)
@@ -1015,17 +1009,17 @@ int cpu_cycle(void)
 				set_C(1);
 			c.cycles += 1;
 		break;
-		case 0x28:	/* JR Z, rel8 */
+		OP(0x28):	/* JR Z, rel8 */
 			if(flag_Z == 1)
 			{
-				c.PC += (signed char)mem_get_byte(c.PC) + 1;
+				c.PC += (signed char)IMM8 + 1;
 				c.cycles += 3;
 			} else {
 				c.PC += 1;
 				c.cycles += 2;
 			}
 		break;
-		case 0x29:	/* ADD HL, HL */
+		OP(0x29):	/* ADD HL, HL */
 			i = get_HL()*2;
 			set_H((i&0x7FF) < (get_HL()&0x7FF));
 			set_C(i > 0xFFFF);
@@ -1033,97 +1027,91 @@ int cpu_cycle(void)
 			set_N(0);
 			c.cycles += 2;
 		break;
-		case 0x2A:	/* LDI A, (HL) */
+		OP(0x2A):	/* LDI A, (HL) */
 			s = get_HL();
 			c.A = mem_get_byte(s);
 			set_HL(s+1);
 			c.cycles += 2;
 		break;
-		case 0x2B: 	/* DEC HL */
+		OP(0x2B): 	/* DEC HL */
 			set_HL(get_HL()-1);
 			c.cycles += 2;
 		break;
-		case 0x2C:	/* INC L */
+		OP(0x2C):	/* INC L */
 			INC(c.L);
 		break;
-		case 0x2D:	/* DEC L */
+		OP(0x2D):	/* DEC L */
 			DEC(c.L);
 		break;
-		case 0x2E:	/* LD L, imm8 */
+		OP(0x2E):	/* LD L, imm8 */
 			LDRIMM8(c.L);
 		break;
-		case 0x2F:	/* CPL */
+		OP(0x2F):	/* CPL */
 			c.A = ~c.A;
 			set_N(1);
 			set_H(1);
 			c.cycles += 1;
 		break;
-		case 0x30:	/* JR NC, rel8 */
+		OP(0x30):	/* JR NC, rel8 */
 			if(flag_C == 0)
 			{
-				c.PC += (signed char)mem_get_byte(c.PC) + 1;
+				c.PC += (signed char)IMM8 + 1;
 				c.cycles += 3;
 			} else {
 				c.PC += 1;
 				c.cycles += 2;
 			}
 		break;
-		case 0x31:	/* LD SP, imm16 */
-			c.SP = mem_get_word(c.PC);
+		OP(0x31):	/* LD SP, imm16 */
+			c.SP = IMM16;
 			c.PC += 2;
 			c.cycles += 3;
 		break;
-		case 0x32:	/* LDD (HL), A */
+		OP(0x32):	/* LDD (HL), A */
 			i = get_HL();
 			mem_write_byte(i, c.A);
 			set_HL(i-1);
 			c.cycles += 2;
 		break;
-		case 0x33:	/* INC SP */
+		OP(0x33):	/* INC SP */
 			c.SP++;
 			c.cycles += 2;
 		break;
-		case 0x34:	/* INC (HL) */
+		OP(0x34):	/* INC (HL) */
 			t = mem_get_byte(get_HL());
-			t++;
+			INC(t);
 			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			set_N(0);
-			set_H((t & 0xF) == 0);
-			c.cycles += 3;
+			c.cycles += 2;
 		break;
-		case 0x35:	/* DEC (HL) */
+		OP(0x35):	/* DEC (HL) */
 			t = mem_get_byte(get_HL());
-			t--;
+			DEC(t);
 			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			set_N(1);
-			set_H((t & 0xF) == 0xF);
-			c.cycles += 3;
+			c.cycles += 2;
 		break;
-		case 0x36:	/* LD (HL), imm8 */
-			t = mem_get_byte(c.PC);
+		OP(0x36):	/* LD (HL), imm8 */
+			t = IMM8;
 			mem_write_byte(get_HL(), t);
 			c.PC += 1;
 			c.cycles += 3;
 		break;
-		case 0x37:	/* SCF */
+		OP(0x37):	/* SCF */
 			set_N(0);
 			set_H(0);
 			set_C(1);
 			c.cycles += 1;
 		break;
-		case 0x38:  /* JR C, rel8 */
+		OP(0x38):  /* JR C, rel8 */
 			if(flag_C)
 			{
-				c.PC += (signed char)mem_get_byte(c.PC) + 1;
+				c.PC += (signed char)IMM8 + 1;
 				c.cycles += 3;
 			} else {
 				c.PC += 1;
 				c.cycles += 2;
 			}
 		break;
-		case 0x39:	/* ADD HL, SP */
+		OP(0x39):	/* ADD HL, SP */
 			i = get_HL() + c.SP;
 			set_H((i&0x7FF) < (get_HL()&0x7FF));
 			set_C(i > 0xFFFF);
@@ -1131,322 +1119,276 @@ int cpu_cycle(void)
 			set_HL(i);
 			c.cycles += 2;
 		break;
-		case 0x3A:	/* LDD A, (HL) */
+		OP(0x3A):	/* LDD A, (HL) */
 			c.A = mem_get_byte(get_HL());
 			set_HL(get_HL()-1);
 			c.cycles += 2;
 		break;
-		case 0x3B:	/* DEC SP */
+		OP(0x3B):	/* DEC SP */
 			c.SP--;
 			c.cycles += 2;
 		break;
-		case 0x3C:	/* INC A */
+		OP(0x3C):	/* INC A */
 			INC(c.A);
 		break;
-		case 0x3D:	/* DEC A */
+		OP(0x3D):	/* DEC A */
 			DEC(c.A);
 		break;
-		case 0x3E:	/* LD A, imm8 */
+		OP(0x3E):	/* LD A, imm8 */
 			LDRIMM8(c.A);
 		break;
-		case 0x3F:	/* CCF */
+		OP(0x3F):	/* CCF */
 			set_N(0);
 			set_H(0);
 			set_C(!flag_C);
 			c.cycles += 1;
 		break;
-		case 0x40:	/* LD B, B */
+		OP(0x40):	/* LD B, B */
 			LDRR(c.B, c.B);
 		break;
-		case 0x41:	/* LD B, C */
+		OP(0x41):	/* LD B, C */
 			LDRR(c.B, c.C);
 		break;
-		case 0x42:	/* LD B, D */
+		OP(0x42):	/* LD B, D */
 			LDRR(c.B, c.D);
 		break;
-		case 0x43:	/* LD B, E */
+		OP(0x43):	/* LD B, E */
 			LDRR(c.B, c.E);
 		break;
-		case 0x44:	/* LD B, H */
+		OP(0x44):	/* LD B, H */
 			LDRR(c.B, c.H);
 		break;
-		case 0x45:	/* LD B, L */
+		OP(0x45):	/* LD B, L */
 			LDRR(c.B, c.L);
 		break;
-		case 0x46:	/* LD B, (HL) */
+		OP(0x46):	/* LD B, (HL) */
 			c.B = mem_get_byte(get_HL());
 			c.cycles += 2;
 		break;
-		case 0x47:	/* LD B, A */
+		OP(0x47):	/* LD B, A */
 			LDRR(c.B, c.A);
 		break;
-		case 0x48:	/* LD C, B */
+		OP(0x48):	/* LD C, B */
 			LDRR(c.C, c.B);
 		break;
-		case 0x49:	/* LD C, C */
+		OP(0x49):	/* LD C, C */
 			LDRR(c.C, c.C);
 		break;
-		case 0x4A:	/* LD C, D */
+		OP(0x4A):	/* LD C, D */
 			LDRR(c.C, c.D);
 		break;
-		case 0x4B:	/* LD C, E */
+		OP(0x4B):	/* LD C, E */
 			LDRR(c.C, c.E);
 		break;
-		case 0x4C:	/* LD C, H */
+		OP(0x4C):	/* LD C, H */
 			LDRR(c.C, c.H);
 		break;
-		case 0x4D:	/* LD C, L */
+		OP(0x4D):	/* LD C, L */
 			LDRR(c.C, c.L);
 		break;
-		case 0x4E:	/* LD C, (HL) */
+		OP(0x4E):	/* LD C, (HL) */
 			c.C = mem_get_byte(get_HL());
 			c.cycles += 2;
 		break;
-		case 0x4F:	/* LD C, A */
+		OP(0x4F):	/* LD C, A */
 			LDRR(c.C, c.A);
 		break;
-		case 0x50:	/* LD D, B */
+		OP(0x50):	/* LD D, B */
 			LDRR(c.D, c.B);
 		break;
-		case 0x51:	/* LD D, C */
+		OP(0x51):	/* LD D, C */
 			LDRR(c.D, c.C);
 		break;
-		case 0x52:	/* LD D, D */
+		OP(0x52):	/* LD D, D */
 			LDRR(c.D, c.D);
 		break;
-		case 0x53:	/* LD D, E */
+		OP(0x53):	/* LD D, E */
 			LDRR(c.D, c.E);
 		break;
-		case 0x54:	/* LD D, H */
+		OP(0x54):	/* LD D, H */
 			LDRR(c.D, c.H);
 		break;
-		case 0x55:	/* LD D, L */
+		OP(0x55):	/* LD D, L */
 			LDRR(c.D, c.L);
 		break;
-		case 0x56:	/* LD D, (HL) */
+		OP(0x56):	/* LD D, (HL) */
 			c.D = mem_get_byte(get_HL());
 			c.cycles += 2;
 		break;
-		case 0x57:	/* LD D, A */
+		OP(0x57):	/* LD D, A */
 			LDRR(c.D, c.A);
 		break;
-		case 0x58:	/* LD E, B */
+		OP(0x58):	/* LD E, B */
 			LDRR(c.E, c.B);
 		break;
-		case 0x59:	/* LD E, C */
+		OP(0x59):	/* LD E, C */
 			LDRR(c.E, c.C);
 		break;
-		case 0x5A:	/* LD E, D */
+		OP(0x5A):	/* LD E, D */
 			LDRR(c.E, c.D);
 		break;
-		case 0x5B:	/* LD E, E */
+		OP(0x5B):	/* LD E, E */
 			LDRR(c.E, c.E);
 		break;
-		case 0x5C:	/* LD E, H */
+		OP(0x5C):	/* LD E, H */
 			LDRR(c.E, c.H);
 		break;
-		case 0x5D:	/* LD E, L */
+		OP(0x5D):	/* LD E, L */
 			LDRR(c.E, c.L);
 		break;
-		case 0x5E:	/* LD E, (HL) */
+		OP(0x5E):	/* LD E, (HL) */
 			c.E = mem_get_byte(get_HL());
 			c.cycles += 2;
 		break;
-		case 0x5F:	/* LD E, A */
+		OP(0x5F):	/* LD E, A */
 			LDRR(c.E, c.A);
 		break;
-		case 0x60:	/* LD H, B */
+		OP(0x60):	/* LD H, B */
 			LDRR(c.H, c.B);
 		break;
-		case 0x61:	/* LD H, C */
+		OP(0x61):	/* LD H, C */
 			LDRR(c.H, c.C);
 		break;
-		case 0x62:	/* LD H, D */
+		OP(0x62):	/* LD H, D */
 			LDRR(c.H, c.D);
 		break;
-		case 0x63:	/* LD H, E */
+		OP(0x63):	/* LD H, E */
 			LDRR(c.H, c.E);
 		break;
-		case 0x64:	/* LD H, H */
+		OP(0x64):	/* LD H, H */
 			LDRR(c.H, c.H);
 		break;
-		case 0x65:	/* LD H, L */
+		OP(0x65):	/* LD H, L */
 			LDRR(c.H, c.L);
 		break;
-		case 0x66:	/* LD H, (HL) */
+		OP(0x66):	/* LD H, (HL) */
 			c.H = mem_get_byte(get_HL());
 			c.cycles += 2;
 		break;
-		case 0x67:	/* LD H, A */
+		OP(0x67):	/* LD H, A */
 			LDRR(c.H, c.A);
 		break;
-		case 0x68:	/* LD L, B */
+		OP(0x68):	/* LD L, B */
 			LDRR(c.L, c.B);
 		break;
-		case 0x69:	/* LD L, C */
+		OP(0x69):	/* LD L, C */
 			LDRR(c.L, c.C);
 		break;
-		case 0x6A:	/* LD L, D */
+		OP(0x6A):	/* LD L, D */
 			LDRR(c.L, c.D);
 		break;
-		case 0x6B:	/* LD L, E */
+		OP(0x6B):	/* LD L, E */
 			LDRR(c.L, c.E);
 		break;
-		case 0x6C:	/* LD L, H */
+		OP(0x6C):	/* LD L, H */
 			LDRR(c.L, c.H);
 		break;
-		case 0x6D:	/* LD L, L */
+		OP(0x6D):	/* LD L, L */
 			LDRR(c.L, c.L);
 		break;
-		case 0x6E:	/* LD L, (HL) */
+		OP(0x6E):	/* LD L, (HL) */
 			c.L = mem_get_byte(get_HL());
 			c.cycles += 2;
 		break;
-		case 0x6F:	/* LD L, A */
+		OP(0x6F):	/* LD L, A */
 			LDRR(c.L, c.A);
 		break;
-		case 0x70:	/* LD (HL), B */
+		OP(0x70):	/* LD (HL), B */
 			mem_write_byte(get_HL(), c.B);
 			c.cycles += 2;
 		break;
-		case 0x71:	/* LD (HL), C */
+		OP(0x71):	/* LD (HL), C */
 			mem_write_byte(get_HL(), c.C);
 			c.cycles += 2;
 		break;
-		case 0x72:	/* LD (HL), D */
+		OP(0x72):	/* LD (HL), D */
 			mem_write_byte(get_HL(), c.D);
 			c.cycles += 2;
 		break;
-		case 0x73:	/* LD (HL), E */
+		OP(0x73):	/* LD (HL), E */
 			mem_write_byte(get_HL(), c.E);
 			c.cycles += 2;
 		break;
-		case 0x74:	/* LD (HL), H */
+		OP(0x74):	/* LD (HL), H */
 			mem_write_byte(get_HL(), c.H);
 			c.cycles += 2;
 		break;
-		case 0x75:	/* LD (HL), L */
+		OP(0x75):	/* LD (HL), L */
 			mem_write_byte(get_HL(), c.L);
 			c.cycles += 2;
 		break;
-		case 0x76:	/* HALT */
+		OP(0x76):	/* HALT */
 			if(interrupt_get_enabled())
 			{
-				halted = 1;
+				c.halted = 1;
 				c.cycles += 1;
 				break;
 			}
 
 			if(!interrupt_pending())
-				halted = 1;
+				c.halted = 1;
 			else
-				halt_bug = 1;
+				c.halt_bug = 1;
 
 			c.cycles += 1;
 		break;
-		case 0x77:	/* LD (HL), A */
+		OP(0x77):	/* LD (HL), A */
 			mem_write_byte(get_HL(), c.A);
 			c.cycles += 2;
 		break;
-		case 0x78:	/* LD A, B */
+		OP(0x78):	/* LD A, B */
 			LDRR(c.A, c.B);
 		break;
-		case 0x79:	/* LD A, C */
+		OP(0x79):	/* LD A, C */
 			LDRR(c.A, c.C);
 		break;
-		case 0x7A:	/* LD A, D */
+		OP(0x7A):	/* LD A, D */
 			LDRR(c.A, c.D);
 		break;
-		case 0x7B:	/* LD A, E */
+		OP(0x7B):	/* LD A, E */
 			LDRR(c.A, c.E);
 		break;
-		case 0x7C:	/* LD A, H */
+		OP(0x7C):	/* LD A, H */
 			LDRR(c.A, c.H);
 		break;
-		case 0x7D:	/* LD A, L */
+		OP(0x7D):	/* LD A, L */
 			LDRR(c.A, c.L);
 		break;
-		case 0x7E:	/* LD A, (HL) */
+		OP(0x7E):	/* LD A, (HL) */
 			c.cycles++;
 			c.A = mem_get_byte(get_HL());
 			c.cycles++;
 		break;
-		case 0x7F:	/* LD A, A */
+		OP(0x7F):	/* LD A, A */
 			LDRR(c.A, c.A);
 		break;
-		case 0x80:	/* ADD B */
-			i = c.A + c.B;
-			set_H((c.A&0xF)+(c.B&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
-			c.A = i;
-			set_Z(!c.A);
-			c.cycles += 1;
-		break;
-		case 0x81:	/* ADD C */
-			i = c.A + c.C;
-			set_H((c.A&0xF)+(c.C&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
-			c.A = i;
-			set_Z(!c.A);
-			c.cycles += 1;
+		OP(0x80):	/* ADD B */
+			ADDR(c.B);
 		break;
-		case 0x82:	/* ADD D */
-			i = c.A + c.D;
-			set_H((c.A&0xF)+(c.D&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
-			c.A = i;
-			set_Z(!c.A);
-			c.cycles += 1;
+		OP(0x81):	/* ADD C */
+			ADDR(c.C);
 		break;
-		case 0x83:	/* ADD E */
-			i = c.A + c.E;
-			set_H((c.A&0xF)+(c.E&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
-			c.A = i;
-			set_Z(!c.A);
-			c.cycles += 1;
+		OP(0x82):	/* ADD D */
+			ADDR(c.D);
 		break;
-		case 0x84:	/* ADD H */
-			i = c.A + c.H;
-			set_H((c.A&0xF)+(c.H&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
-			c.A = i;
-			set_Z(!c.A);
-			c.cycles += 1;
+		OP(0x83):	/* ADD E */
+			ADDR(c.E);
 		break;
-		case 0x85:	/* ADD L */
-			i = c.A + c.L;
-			set_H((c.A&0xF)+(c.L&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
-			c.A = i;
-			set_Z(!c.A);
-			c.cycles += 1;
+		OP(0x84):	/* ADD H */
+			ADDR(c.H);
 		break;
-		case 0x86:	/* ADD (HL) */
-			i = c.A + mem_get_byte(get_HL());
-			set_H((i&0xF) < (c.A&0xF));
-			set_C(i > 0xFF);
-			set_N(0);
-			c.A = i;
-			set_Z(!c.A);
-			c.cycles += 2;
+		OP(0x85):	/* ADD L */
+			ADDR(c.L);
 		break;
-		case 0x87:	/* ADD A */
-			i = c.A + c.A;
-			set_H((c.A&0xF)+(c.A&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
-			c.A = i;
-			set_Z(!c.A);
+		OP(0x86):	/* ADD (HL) */
+			t = mem_get_byte(get_HL());
+			ADDR(t);
 			c.cycles += 1;
 		break;
-		case 0x88:	/* ADC B */
+		OP(0x87):	/* ADD A */
+			ADDR(c.A);
+		break;
+		OP(0x88):	/* ADC B */
 			i = c.A + c.B + flag_C >= 0x100;
 			set_N(0);
 			set_H(((c.A&0xF) + (c.B&0xF) + flag_C) >= 0x10);
@@ -1455,7 +1397,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x89:	/* ADC C */
+		OP(0x89):	/* ADC C */
 			i = c.A + c.C + flag_C >= 0x100;
 			set_N(0);
 			set_H(((c.A&0xF) + (c.C&0xF) + flag_C) >= 0x10);
@@ -1464,7 +1406,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x8A:	/* ADC D */
+		OP(0x8A):	/* ADC D */
 			i = c.A + c.D + flag_C >= 0x100;
 			set_N(0);
 			set_H(((c.A&0xF) + (c.D&0xF) + flag_C) >= 0x10);
@@ -1473,7 +1415,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x8B:	/* ADC E */
+		OP(0x8B):	/* ADC E */
 			i = c.A + c.E + flag_C >= 0x100;
 			set_N(0);
 			set_H(((c.A&0xF) + (c.E&0xF) + flag_C) >= 0x10);
@@ -1482,7 +1424,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x8C:	/* ADC H */
+		OP(0x8C):	/* ADC H */
 			i = c.A + c.H + flag_C >= 0x100;
 			set_N(0);
 			set_H(((c.A&0xF) + (c.H&0xF) + flag_C) >= 0x10);
@@ -1491,7 +1433,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x8D:	/* ADC L */
+		OP(0x8D):	/* ADC L */
 			i = c.A + c.L + flag_C >= 0x100;
 			set_N(0);
 			set_H(((c.A&0xF) + (c.L&0xF) + flag_C) >= 0x10);
@@ -1500,7 +1442,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x8E:	/* ADC (HL) */
+		OP(0x8E):	/* ADC (HL) */
 			t = mem_get_byte(get_HL());
 			i = c.A + t + flag_C >= 0x100;
 			set_N(0);
@@ -1510,7 +1452,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 2;
 		break;
-		case 0x8F:	/* ADC A */
+		OP(0x8F):	/* ADC A */
 			i = c.A + c.A + flag_C >= 0x100;
 			set_N(0);
 			set_H(((c.A&0xF) + (c.A&0xF) + flag_C) >= 0x10);
@@ -1519,37 +1461,33 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x90:	/* SUB B */
+		OP(0x90):	/* SUB B */
 			SUBR(c.B);
 		break;
-		case 0x91:	/* SUB C */
+		OP(0x91):	/* SUB C */
 			SUBR(c.C);
 		break;
-		case 0x92:	/* SUB D */
+		OP(0x92):	/* SUB D */
 			SUBR(c.D);
 		break;
-		case 0x93:	/* SUB E */
+		OP(0x93):	/* SUB E */
 			SUBR(c.E);
 		break;
-		case 0x94:	/* SUB H */
+		OP(0x94):	/* SUB H */
 			SUBR(c.H);
 		break;
-		case 0x95:	/* SUB L */
+		OP(0x95):	/* SUB L */
 			SUBR(c.L);
 		break;
-		case 0x96:	/* SUB (HL) */
+		OP(0x96):	/* SUB (HL) */
 			t = mem_get_byte(get_HL());
-			set_C((c.A - t) < 0);
-			set_H(((c.A - t)&0xF) > (c.A&0xF));
-			c.A -= t;
-			set_Z(!c.A);
-			set_N(1);
-			c.cycles += 2;
+			SUBR(t);
+			c.cycles += 1;
 		break;
-		case 0x97:	/* SUB A */
+		OP(0x97):	/* SUB A */
 			SUBR(c.A);
 		break;
-		case 0x98:	/* SBC B */
+		OP(0x98):	/* SBC B */
 			t = flag_C + c.B;
 			set_H(((c.A&0xF) - (c.B&0xF) - flag_C) < 0);
 			set_C((c.A - c.B - flag_C) < 0);
@@ -1558,7 +1496,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x99:	/* SBC C */
+		OP(0x99):	/* SBC C */
 			t = flag_C + c.C;
 			set_H(((c.A&0xF) - (c.C&0xF) - flag_C) < 0);
 			set_C((c.A - c.C - flag_C) < 0);
@@ -1567,7 +1505,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x9A:	/* SBC D */
+		OP(0x9A):	/* SBC D */
 			t = flag_C + c.D;
 			set_H(((c.A&0xF) - (c.D&0xF) - flag_C) < 0);
 			set_C((c.A - c.D - flag_C) < 0);
@@ -1576,7 +1514,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x9B:	/* SBC E */
+		OP(0x9B):	/* SBC E */
 			t = flag_C + c.E;
 			set_H(((c.A&0xF) - (c.E&0xF) - flag_C) < 0);
 			set_C((c.A - c.E - flag_C) < 0);
@@ -1585,7 +1523,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x9C:	/* SBC H */
+		OP(0x9C):	/* SBC H */
 			t = flag_C + c.H;
 			set_H(((c.A&0xF) - (c.H&0xF) - flag_C) < 0);
 			set_C((c.A - c.H - flag_C) < 0);
@@ -1594,7 +1532,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x9D:	/* SBC L */
+		OP(0x9D):	/* SBC L */
 			t = flag_C + c.L;
 			set_H(((c.A&0xF) - (c.L&0xF) - flag_C) < 0);
 			set_C((c.A - c.L - flag_C) < 0);
@@ -1603,7 +1541,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0x9E:	/* SBC (HL) */
+		OP(0x9E):	/* SBC (HL) */
 			t = mem_get_byte(get_HL());
 			b = flag_C + t;
 			set_H(((c.A&0xF) - (t&0xF) - flag_C) < 0);
@@ -1613,7 +1551,7 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 2;
 		break;
-		case 0x9F:	/* SBC A */
+		OP(0x9F):	/* SBC A */
 			t = flag_C + c.A;
 			set_H(((c.A&0xF) - (c.A&0xF) - flag_C) < 0);
 			set_C((c.A - c.A - flag_C) < 0);
@@ -1622,117 +1560,111 @@ int cpu_cycle(void)
 			set_Z(!c.A);
 			c.cycles += 1;
 		break;
-		case 0xA0:	/* AND B */
+		OP(0xA0):	/* AND B */
 			ANDR(c.B);
 		break;
-		case 0xA1:	/* AND C */
+		OP(0xA1):	/* AND C */
 			ANDR(c.C);
 		break;
-		case 0xA2:	/* AND D */
+		OP(0xA2):	/* AND D */
 			ANDR(c.D);
 		break;
-		case 0xA3:	/* AND E */
+		OP(0xA3):	/* AND E */
 			ANDR(c.E);
 		break;
-		case 0xA4:	/* AND H */
+		OP(0xA4):	/* AND H */
 			ANDR(c.H);
 		break;
-		case 0xA5:	/* AND L */
+		OP(0xA5):	/* AND L */
 			ANDR(c.L);
 		break;
-		case 0xA6:	/* AND (HL) */
-			c.A &= mem_get_byte(get_HL());
-			set_Z(!c.A);
-			set_H(1);
-			set_N(0);
-			set_C(0);
-			c.cycles += 2;
+		OP(0xA6):	/* AND (HL) */
+			t = mem_get_byte(get_HL());
+			ANDR(t);
+			c.cycles += 1;
 		break;
-		case 0xA7:	/* AND A */
+		OP(0xA7):	/* AND A */
 			ANDR(c.A);
 		break;
-		case 0xA8:	/* XOR B */
+		OP(0xA8):	/* XOR B */
 			XORR(c.B);
 		break;
-		case 0xA9:	/* XOR C */
+		OP(0xA9):	/* XOR C */
 			XORR(c.C);
 		break;
-		case 0xAA:	/* XOR D */
+		OP(0xAA):	/* XOR D */
 			XORR(c.D);
 		break;
-		case 0xAB:	/* XOR E */
+		OP(0xAB):	/* XOR E */
 			XORR(c.E);
 		break;
-		case 0xAC:	/* XOR H */
+		OP(0xAC):	/* XOR H */
 			XORR(c.H);
 		break;
-		case 0xAD:	/* XOR L */
+		OP(0xAD):	/* XOR L */
 			XORR(c.L);
 		break;
-		case 0xAE:	/* XOR (HL) */
-			c.A ^= mem_get_byte(get_HL());
-			c.F = (!c.A)<<7;
-			c.cycles += 2;
+		OP(0xAE):	/* XOR (HL) */
+			t = mem_get_byte(get_HL());
+			XORR(t);
+			c.cycles += 1;
 		break;
-		case 0xAF:	/* XOR A */
+		OP(0xAF):	/* XOR A */
 			XORR(c.A);
 		break;
-		case 0xB0:	/* OR B */
+		OP(0xB0):	/* OR B */
 			ORR(c.B);
 		break;
-		case 0xB1:	/* OR C */
+		OP(0xB1):	/* OR C */
 			ORR(c.C);
 		break;
-		case 0xB2:	/* OR D */
+		OP(0xB2):	/* OR D */
 			ORR(c.D);
 		break;
-		case 0xB3:	/* OR E */
+		OP(0xB3):	/* OR E */
 			ORR(c.E);
 		break;
-		case 0xB4:	/* OR H */
+		OP(0xB4):	/* OR H */
 			ORR(c.H);
 		break;
-		case 0xB5:	/* OR L */
+		OP(0xB5):	/* OR L */
 			ORR(c.L);
 		break;
-		case 0xB6:	/* OR (HL) */
-			c.A |= mem_get_byte(get_HL());
-			c.F = (!c.A)<<7;
-			c.cycles += 2;
+		OP(0xB6):	/* OR (HL) */
+			t = mem_get_byte(get_HL());
+			ORR(t);
+			c.cycles += 1;
 		break;
-		case 0xB7:	/* OR A */
+		OP(0xB7):	/* OR A */
 			ORR(c.A);
 		break;
-		case 0xB8:	/* CP B */
+		OP(0xB8):	/* CP B */
 			CPR(c.B);
 		break;
-		case 0xB9:	/* CP C */
+		OP(0xB9):	/* CP C */
 			CPR(c.C);
 		break;
-		case 0xBA:	/* CP D */
+		OP(0xBA):	/* CP D */
 			CPR(c.D);
 		break;
-		case 0xBB:	/* CP E */
+		OP(0xBB):	/* CP E */
 			CPR(c.E);
 		break;
-		case 0xBC:	/* CP H */
+		OP(0xBC):	/* CP H */
 			CPR(c.H);
 		break;
-		case 0xBD:	/* CP L */
+		OP(0xBD):	/* CP L */
 			CPR(c.L);
 		break;
-		case 0xBE:	/* CP (HL) */
+		OP(0xBE):	/* CP (HL) */
 			t = mem_get_byte(get_HL());
-			set_Z(c.A == t);
-			set_H(((c.A - t)&0xF) > (c.A&0xF));
-			set_N(1);
-			set_C((c.A - t) < 0);
-			c.cycles += 2;
+			CPR(t);
+			c.cycles += 1;
 		break;
-		case 0xBF:	/* CP A */
+		OP(0xBF):	/* CP A */
 			CPR(c.A);
 		break;
-		case 0xC0:	/* RET NZ */
+		OP(0xC0):	/* RET NZ */
 			if(!flag_Z)
 			{
 				c.PC = mem_get_word(c.SP);
@@ -1742,60 +1674,56 @@ int cpu_cycle(void)
 				c.cycles += 2;
 			}
 		break;
-		case 0xC1:	/* POP BC */
+		OP(0xC1):	/* POP BC */
 			s = mem_get_word(c.SP);
 			set_BC(s);
 			c.SP += 2;
 			c.cycles += 3;
 		break;
-		case 0xC2:	/* JP NZ, mem16 */
+		OP(0xC2):	/* JP NZ, mem16 */
 			if(flag_Z == 0)
 			{
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 4;
 			} else {
 				c.PC += 2;
 				c.cycles += 3;
 			}
 		break;
-		case 0xC3:	/* JP imm16 */
-			c.PC = mem_get_word(c.PC);
+		OP(0xC3):	/* JP imm16 */
+			c.PC = IMM16;
 			c.cycles += 4;
 		break;
-		case 0xC4:	/* CALL NZ, imm16 */
+		OP(0xC4):	/* CALL NZ, imm16 */
 			if(flag_Z == 0)
 			{
 				c.SP -= 2;
 				mem_write_word(c.SP, c.PC+2);
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 6;
 			} else {
 				c.PC += 2;
 				c.cycles += 3;
 			}
 		break;
-		case 0xC5:	/* PUSH BC */
+		OP(0xC5):	/* PUSH BC */
 			c.SP -= 2;
 			mem_write_word(c.SP, get_BC());
 			c.cycles += 4;
 		break;
-		case 0xC6:	/* ADD A, imm8 */
-			t = mem_get_byte(c.PC);
-			set_C((c.A + t) >= 0x100);
-			set_H(((c.A + t)&0xF) < (c.A&0xF));
-			c.A += t;
-			set_N(0);
-			set_Z(!c.A);
+		OP(0xC6):	/* ADD A, imm8 */
+			t = IMM8;
+			ADDR(t);
 			c.PC += 1;
-			c.cycles += 2;
+			c.cycles += 1;
 		break;
-		case 0xC7:	/* RST 00 */
+		OP(0xC7):	/* RST 00 */
 			c.SP -= 2;
 			mem_write_word(c.SP, c.PC);
 			c.PC = 0;
 			c.cycles += 4;
 		break;
-		case 0xC8:	/* RET Z */
+		OP(0xC8):	/* RET Z */
 			if(flag_Z == 1)
 			{
 				c.PC = mem_get_word(c.SP);
@@ -1805,46 +1733,46 @@ int cpu_cycle(void)
 				c.cycles += 2;
 			}
 		break;
-		case 0xC9:	/* RET */
+		OP(0xC9):	/* RET */
 			c.PC = mem_get_word(c.SP);
 			c.SP += 2;
 			c.cycles += 4;
 		break;
-		case 0xCA:	/* JP z, mem16 */
+		OP(0xCA):	/* JP z, mem16 */
 			if(flag_Z == 1)
 			{
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 4;
 			} else {
 				c.PC += 2;
 				c.cycles += 3;
 			}
 		break;
-		case 0xCB:	/* RLC/RRC/RL/RR/SLA/SRA/SWAP/SRL/BIT/RES/SET */
-			decode_CB(mem_get_byte(c.PC));
+		OP(0xCB):	/* RLC/RRC/RL/RR/SLA/SRA/SWAP/SRL/BIT/RES/SET */
+			decode_CB(IMM8);
 			c.PC += 1;
 			c.cycles += 2;
 		break;
-		case 0xCC:	/* CALL Z, imm16 */
+		OP(0xCC):	/* CALL Z, imm16 */
 			if(flag_Z == 1)
 			{
 				c.SP -= 2;
 				mem_write_word(c.SP, c.PC+2);
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 6;
 			} else {
 				c.PC += 2;
 				c.cycles += 3;
 			}
 		break;
-		case 0xCD:	/* call imm16 */
+		OP(0xCD):	/* call imm16 */
 			c.SP -= 2;
 			mem_write_word(c.SP, c.PC+2);
-			c.PC = mem_get_word(c.PC);
+			c.PC = IMM16;
 			c.cycles += 6;
 		break;
-		case 0xCE:	/* ADC a, imm8 */
-			t = mem_get_byte(c.PC);
+		OP(0xCE):	/* ADC a, imm8 */
+			t = IMM8;
 			i = c.A + t + flag_C >= 0x100;
 			set_N(0);
 			set_H(((c.A&0xF) + (t&0xF) + flag_C) >= 0x10);
@@ -1854,13 +1782,13 @@ int cpu_cycle(void)
 			c.PC += 1;
 			c.cycles += 2;
 		break;
-		case 0xCF:	/* RST 08 */
+		OP(0xCF):	/* RST 08 */
 			c.SP -= 2;
 			mem_write_word(c.SP, c.PC);
 			c.PC = 0x0008;
 			c.cycles += 4;
 		break;
-		case 0xD0:	/* RET NC */
+		OP(0xD0):	/* RET NC */
 			if(flag_C == 0)
 			{
 				c.PC = mem_get_word(c.SP);
@@ -1870,56 +1798,52 @@ int cpu_cycle(void)
 				c.cycles += 2;
 			}
 		break;
-		case 0xD1:	/* POP DE */
+		OP(0xD1):	/* POP DE */
 			s = mem_get_word(c.SP);
 			set_DE(s);
 			c.SP += 2;
 			c.cycles += 3;
 		break;
-		case 0xD2:	/* JP NC, mem16 */
+		OP(0xD2):	/* JP NC, mem16 */
 			if(flag_C == 0)
 			{
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 4;
 			} else {
 				c.PC += 2;
 				c.cycles += 3;
 			}
 		break;
-		case 0xD4:	/* CALL NC, mem16 */
+		OP(0xD4):	/* CALL NC, mem16 */
 			if(flag_C == 0)
 			{
 				c.SP -= 2;
 				mem_write_word(c.SP, c.PC+2);
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 6;
 			} else {
 				c.PC += 2;
 				c.cycles += 3;
 			}
 		break;
-		case 0xD5:	/* PUSH DE */
+		OP(0xD5):	/* PUSH DE */
 			c.SP -= 2;
 			mem_write_word(c.SP, get_DE());
 			c.cycles += 4;
 		break;
-		case 0xD6:	/* SUB A, imm8 */
-			t = mem_get_byte(c.PC);
-			set_C((c.A - t) < 0);
-			set_H(((c.A - t)&0xF) > (c.A&0xF));
-			c.A -= t;
-			set_N(1);
-			set_Z(!c.A);
+		OP(0xD6):	/* SUB A, imm8 */
+			t = IMM8;
+			SUBR(t);
 			c.PC += 1;
-			c.cycles += 2;
+			c.cycles += 1;
 		break;
-		case 0xD7:	/* RST 10 */
+		OP(0xD7):	/* RST 10 */
 			c.SP -= 2;
 			mem_write_word(c.SP, c.PC);
 			c.PC = 0x0010;
 			c.cycles += 4;
 		break;
-		case 0xD8:	/* RET C */
+		OP(0xD8):	/* RET C */
 			if(flag_C == 1)
 			{
 				c.PC = mem_get_word(c.SP);
@@ -1929,36 +1853,36 @@ int cpu_cycle(void)
 				c.cycles += 2;
 			}
 		break;
-		case 0xD9:	/* RETI */
+		OP(0xD9):	/* RETI */
 			c.PC = mem_get_word(c.SP);
 			c.SP += 2;
 			c.cycles += 4;
 			interrupt_enable();
 		break;
-		case 0xDA:	/* JP C, mem16 */
+		OP(0xDA):	/* JP C, mem16 */
 			if(flag_C)
 			{
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 4;
 			} else {
 				c.PC += 2;
 				c.cycles += 3;
 			}
 		break;
-		case 0xDC:	/* CALL C, mem16 */
+		OP(0xDC):	/* CALL C, mem16 */
 			if(flag_C == 1)
 			{
 				c.SP -= 2;
 				mem_write_word(c.SP, c.PC+2);
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 6;
 			} else {
 				c.PC += 2;
 				c.cycles += 3;
 			}
 		break;
-		case 0xDE:	/* SBC A, imm8 */
-			t = mem_get_byte(c.PC);
+		OP(0xDE):	/* SBC A, imm8 */
+			t = IMM8;
 			b = flag_C;
 			set_H(((t&0xF) + flag_C) > (c.A&0xF));
 			set_C(t + flag_C > c.A);
@@ -1968,52 +1892,48 @@ int cpu_cycle(void)
 			c.PC += 1;
 			c.cycles += 2;
 		break;
-		case 0xDF:	/* RST 18 */
+		OP(0xDF):	/* RST 18 */
 			c.SP -= 2;
 			mem_write_word(c.SP, c.PC);
 			c.PC = 0x0018;
 			c.cycles += 4;
 		break;
-		case 0xE0:	/* LD (FF00 + imm8), A */
-			t = mem_get_byte(c.PC);
+		OP(0xE0):	/* LD (FF00 + imm8), A */
+			t = IMM8;
 			mem_write_byte(0xFF00 + t, c.A);
 			c.PC += 1;
 			c.cycles += 3;
 		break;
-		case 0xE1:	/* POP HL */
+		OP(0xE1):	/* POP HL */
 			i = mem_get_word(c.SP);
 			set_HL(i);
 			c.SP += 2;
 			c.cycles += 3;
 		break;
-		case 0xE2:	/* LD (FF00 + C), A */
+		OP(0xE2):	/* LD (FF00 + C), A */
 			s = 0xFF00 + c.C;
 			mem_write_byte(s, c.A);
 			c.cycles += 2;
 		break;
-		case 0xE5:	/* PUSH HL */
+		OP(0xE5):	/* PUSH HL */
 			c.SP -= 2;
 			mem_write_word(c.SP, get_HL());
 			c.cycles += 4;
 		break;
-		case 0xE6:	/* AND A, imm8 */
-			t = mem_get_byte(c.PC);
-			set_N(0);
-			set_H(1);
-			set_C(0);
-			c.A = t & c.A;
-			set_Z(!c.A);
+		OP(0xE6):	/* AND A, imm8 */
+			t = IMM8;
+			ANDR(t);
 			c.PC += 1;
-			c.cycles += 2;
+			c.cycles += 1;
 		break;
-		case 0xE7:	/* RST 20 */
+		OP(0xE7):	/* RST 20 */
 			c.SP -= 2;
 			mem_write_word(c.SP, c.PC);
 			c.PC = 0x20;
 			c.cycles += 4;
 		break;
-		case 0xE8:	/* ADD SP, imm8 */
-			i = mem_get_byte(c.PC);
+		OP(0xE8):	/* ADD SP, imm8 */
+			i = IMM8;
 			set_Z(0);
 			set_N(0);
 			set_C(((c.SP+i)&0xFF) < (c.SP&0xFF));
@@ -2022,67 +1942,67 @@ int cpu_cycle(void)
 			c.PC += 1;
 			c.cycles += 4;
 		break;
-		case 0xE9:	/* JP HL */
+		OP(0xE9):	/* JP HL */
 			c.PC = get_HL();
 			c.cycles += 1;
 		break;
-		case 0xEA:	/* LD (mem16), a */
-			s = mem_get_word(c.PC);
+		OP(0xEA):	/* LD (mem16), a */
+			s = IMM16;
 			mem_write_byte(s, c.A);
 			c.PC += 2;
 			c.cycles += 4;
 		break;
-		case 0xEE:	/* XOR A, imm8 */
-			c.A ^= mem_get_byte(c.PC);
-			c.F = (!c.A)<<7;
+		OP(0xEE):	/* XOR A, imm8 */
+			t = IMM8;
+			XORR(t);
 			c.PC += 1;
-			c.cycles += 2;
+			c.cycles += 1;
 		break;
-		case 0xEF:	/* RST 28 */
+		OP(0xEF):	/* RST 28 */
 			c.SP -= 2;
 			mem_write_word(c.SP, c.PC);
 			c.PC = 0x28;
 			c.cycles += 4;
 		break;
-		case 0xF0:	/* LD A, (FF00 + imm8) */
-			t = mem_get_byte(c.PC);
+		OP(0xF0):	/* LD A, (FF00 + imm8) */
+			t = IMM8;
 			c.A = mem_get_byte(0xFF00 + t);
 			c.PC += 1;
 			c.cycles += 3;
 		break;
-		case 0xF1:	/* POP AF */
+		OP(0xF1):	/* POP AF */
 			s = mem_get_word(c.SP);
 			set_AF(s&0xFFF0);
 			c.SP += 2;
 			c.cycles += 3;
 		break;
-		case 0xF2:	/* LD A, (FF00 + c) */
+		OP(0xF2):	/* LD A, (FF00 + c) */
 			c.A = mem_get_byte(0xFF00 + c.C);
 			c.cycles += 2;
 		break;
-		case 0xF3:	/* DI */
+		OP(0xF3):	/* DI */
 			c.cycles += 1;
 			interrupt_disable();
 		break;
-		case 0xF5:	/* PUSH AF */
+		OP(0xF5):	/* PUSH AF */
 			c.SP -= 2;
 			mem_write_word(c.SP, get_AF());
 			c.cycles += 4;
 		break;
-		case 0xF6:	/* OR A, imm8 */
-			c.A |= mem_get_byte(c.PC);
-			c.F = (!c.A)<<7;
+		OP(0xF6):	/* OR A, imm8 */
+			t = IMM8;
+			ORR(t);
 			c.PC += 1;
-			c.cycles += 2;
+			c.cycles += 1;
 		break;
-		case 0xF7:	/* RST 30 */
+		OP(0xF7):	/* RST 30 */
 			c.SP -= 2;
 			mem_write_word(c.SP, c.PC);
 			c.PC = 0x30;
 			c.cycles += 4;
 		break;
-		case 0xF8:	/* LD HL, SP + imm8 */
-			i = mem_get_byte(c.PC);
+		OP(0xF8):	/* LD HL, SP + imm8 */
+			i = IMM8;
 			set_N(0);
 			set_Z(0);
 			set_C(((c.SP+i)&0xFF) < (c.SP&0xFF));
@@ -2091,42 +2011,195 @@ int cpu_cycle(void)
 			c.PC += 1;
 			c.cycles += 3;
 		break;
-		case 0xF9:	/* LD SP, HL */
+		OP(0xF9):	/* LD SP, HL */
 			c.SP = get_HL();
 			c.cycles += 2;
 		break;
-		case 0xFA:	/* LD A, (mem16) */
-			s = mem_get_word(c.PC);
+		OP(0xFA):	/* LD A, (mem16) */
+			s = IMM16;
 			c.A = mem_get_byte(s);
 			c.PC += 2;
 			c.cycles += 4;
 		break;
-		case 0xFB:	/* EI */
+		OP(0xFB):	/* EI */
 			interrupt_enable();
 			c.cycles += 1;
 		break;
-		case 0xFE:	/* CP a, imm8 */
-			t = mem_get_byte(c.PC);
-			set_Z(c.A == t);
-			set_N(1);
-			set_H(((c.A - t)&0xF) > (c.A&0xF));
-			set_C(c.A < t);
+		OP(0xFE):	/* CP a, imm8 */
+			t = IMM8;
+			CPR(t);
 			c.PC += 1;
-			c.cycles += 2;
+			c.cycles += 1;
 		break;
-		case 0xFF:	/* RST 38 */
+		OP(0xFF):	/* RST 38 */
 			c.SP -= 2;
 			mem_write_word(c.SP, c.PC);
 			c.PC = 0x0038;
 			c.cycles += 4;
 		break;
-		default:
+		OP_DEFAULT:
 			printf("Unhandled opcode %02X at %04X\n", b, c.PC);
 			printf("cycles: %d\n", c.cycles);
 			return 0;
 		break;
 	}
 
-	c.prev_cycles += 1;
+	c.prev_cycles = c.cycles;
+	return 1;
+}
+
+/* Fetch, decode and run one op straight from memory */
+int cpu_cycle(void)
+{
+	struct cpu_op op;
+
+	if(is_debugged)
+		cpu_print_debug();
+
+	op.opcode = cpu_fetch(c.PC);
+
+	if(c.halt_bug)
+		c.halt_bug = 0;
+	else
+		c.PC++;
+
+	if(op_len[op.opcode] == 3)
+		op.imm = mem_get_word(c.PC);
+	else if(op_len[op.opcode] == 2)
+		op.imm = cpu_fetch(c.PC);
+
+	return cpu_execute(&op);
+}
+
+/* After an op touching memory, whether the rest of blk can still run */
+static int cpu_block_continues(const struct cpu_block *blk, unsigned int *next)
+{
+	unsigned short pc;
+
+	*next = sched_next();
+	if((int)(c.cycles - *next) > 0)
+		return 0;
+
+	pc = c.PC;
+	interrupt_flush();
+	if(c.PC != pc || gb_current->mem.read_pages[pc>>8] != blk->page)
+		return 0;
+	if(blk->gen && blk->gen != c.cache->gen)
+		return 0;
+
+	return 1;
+}
+
+/* Runs a block until it ends or the plain loop would have stopped fetching
+ * from it. Only ops that touch memory can raise an interrupt, bring an
+ * event forward, switch banks or rewrite the block, so only after those
+ * are the interrupts and the block itself looked at again.
+ */
+static int cpu_run_block(const struct cpu_block *blk)
+{
+	const struct cpu_op *op = blk->ops, *end = &blk->ops[blk->count];
+	unsigned int next = sched_next();
+
+	while(1)
+	{
+		c.PC++;
+		if(!cpu_execute(op))
+			return 0;
+		c.instructions++;
+
+		if(++op == end)
+			return 1;
+
+		if(op[-1].flags & OP_MEM)
+		{
+			if(!cpu_block_continues(blk, &next))
+				return 1;
+		}
+		else if((int)(c.cycles - next) > 0)
+			return 1;
+	}
+}
+
+#ifdef JIT
+/* JIT code hands back each op it doesn't translate to one of these. 2
+ * carries on with the block, anything else is what cpu_run() should get.
+ */
+int cpu_jit_op(const struct cpu_op *op)
+{
+	c.PC++;
+	if(!cpu_execute(op))
+		return 0;
+	c.instructions++;
+
+	return 2;
+}
+
+/* The same for an op touching memory, that isn't the last in its block */
+int cpu_jit_mem(const struct cpu_op *op, const struct cpu_block *blk)
+{
+	if(!cpu_jit_op(op))
+		return 0;
+
+	return cpu_block_continues(blk, &c.cache->next) ? 2 : 1;
+}
+
+static int cpu_jit_block(struct cpu_block *blk)
+{
+	int i;
+
+	if(!c.cache->jit)
+		return 0;
+
+	if((blk->native = jit_compile(c.cache->jit, blk, blk->ops, blk->count)))
+		return 1;
+
+	/* Out of room, start again from nothing */
+	jit_reset(c.cache->jit);
+	for(i = 0; i < BLOCKS; i++)
+		c.cache->blocks[i].native = NULL;
+
+	return !!(blk->native = jit_compile(c.cache->jit, blk, blk->ops, blk->count));
+}
+#endif
+
+/* Run instructions until the cycle counter passes the next scheduled event */
+int cpu_run(void)
+{
+	struct cpu_block *blk;
+
+	while((int)(c.cycles - sched_next()) <= 0)
+	{
+		/* If any interrupts are pending, do them now */
+		interrupt_flush();
+
+		/* Only an event can wake a halted cpu, skip straight past it */
+		if(c.halted)
+		{
+			c.cycles = c.prev_cycles = sched_next() + 1;
+			break;
+		}
+
+		blk = c.halt_bug || is_debugged ? NULL : cpu_get_block();
+		if(blk)
+		{
+#ifdef JIT
+			if(blk->native || (++blk->runs >= JIT_HOT && cpu_jit_block(blk)))
+			{
+				c.cache->next = sched_next();
+				if(!blk->native())
+					return 0;
+				continue;
+			}
+#endif
+			if(!cpu_run_block(blk))
+				return 0;
+			continue;
+		}
+
+		if(!cpu_cycle())
+			return 0;
+		c.instructions++;
+	}
+
 	return 1;
 }
@@ -2,10 +2,30 @@
 #define CPU_H
 #include "rom.h"
 void cpu_init(void);
+void cpu_unload(void);
 int cpu_cycle(void);
+int cpu_run(void);
 unsigned int cpu_get_cycles(void);
+unsigned int cpu_get_instructions(void);
 void cpu_interrupt_begin(void);
 void cpu_interrupt(unsigned short);
 void cpu_unhalt(void);
 int cpu_halted(void);
+void cpu_invalidate_ram(void);
+struct state;
+void cpu_state(struct state *);
+
+/* An op as decoded into a block, see cpu.c */
+#define OP_MEM 1	/* Touches memory, so might raise an interrupt, switch banks or rewrite code */
+#define OP_END 2	/* Jumps, or otherwise wants the whole loop after it */
+
+struct cpu_op {
+	unsigned char opcode;
+	unsigned char flags;
+	unsigned short imm;
+};
+
+struct cpu_block;
+int cpu_jit_op(const struct cpu_op *);
+int cpu_jit_mem(const struct cpu_op *, const struct cpu_block *);
 #endif
@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gb.h"
+#include "rom.h"
+#include "mem.h"
+#include "mbc.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "lcd.h"
+#include "timer.h"
+#include "serial.h"
+#include "apu.h"
+#include "perf.h"
+
+__thread gb_t *gb_current;
+
+/* Make 'gb' the instance the modules work on, returns the old one */
+gb_t *gb_select(gb_t *gb)
+{
+	gb_t *prev = gb_current;
+
+	gb_current = gb;
+
+	return prev;
+}
+
+/* Load 'filename', or if that's NULL use the already mapped 'rom' */
+static gb_t *gb_new(const char *filename, unsigned char *rom, unsigned int size)
+{
+	gb_t *gb, *prev;
+
+	gb = calloc(1, sizeof *gb);
+	if(!gb)
+		return NULL;
+
+	prev = gb_select(gb);
+
+	if(filename ? !rom_load(filename) : !rom_attach(rom, size))
+	{
+		gb_select(prev);
+		free(gb);
+		return NULL;
+	}
+
+	mem_init();
+	mbc_init(filename);
+	cpu_init();
+	interrupt_init();
+	lcd_init();
+	timer_init();
+	serial_init();
+	apu_init();
+
+	gb_select(prev);
+
+	return gb;
+}
+
+gb_t *gb_create(const char *filename)
+{
+	return gb_new(filename, NULL, 0);
+}
+
+/* The ROM isn't copied, it has to outlive the instance */
+gb_t *gb_create_shared(unsigned char *rom, unsigned int size)
+{
+	return gb_new(NULL, rom, size);
+}
+
+void gb_destroy(gb_t *gb)
+{
+	gb_t *prev = gb_select(gb);
+
+	cpu_unload();
+	mbc_unload();
+	rom_unload();
+	gb_select(prev == gb ? NULL : prev);
+	free(gb->ahead);
+	free(gb);
+}
+
+/* Run until a frame is finished, or the cpu reaches cycle 'until' if
+ * 'limit' is set.
+ */
+static int gb_run(gb_t *gb, unsigned int until, int limit)
+{
+	gb_select(gb);
+	gb->frame_done = 0;
+
+	while(1)
+	{
+		perf_begin(PERF_CPU);
+		if(!cpu_run())
+			return GB_ERROR;
+		perf_end(PERF_CPU);
+
+		sched_run();
+
+		if(limit && cpu_get_cycles() >= until)
+		{
+			perf_begin(PERF_APU);
+			apu_end_frame();
+			perf_end(PERF_APU);
+			return GB_CYCLES;
+		}
+		if(gb->frame_done)
+		{
+			perf_begin(PERF_APU);
+			apu_end_frame();
+			perf_end(PERF_APU);
+			return GB_FRAME;
+		}
+	}
+}
+
+int gb_run_frame(gb_t *gb)
+{
+	return gb_run(gb, 0, 0);
+}
+
+int gb_run_until(gb_t *gb, unsigned int cycles)
+{
+	return gb_run(gb, cycles, 1);
+}
+
+/* Snapshots are the instance itself plus the cartridge RAM. Everything
+ * inside points either into the instance or at things that stay put, so
+ * they can only go back into the instance they came from, but cost no
+ * more than a copy. States are for anything else.
+ */
+unsigned int gb_snapshot_size(gb_t *gb)
+{
+	return sizeof *gb + gb->mbc.save_size;
+}
+
+void gb_snapshot(gb_t *gb, unsigned char *buf)
+{
+	memcpy(buf, gb, sizeof *gb);
+	memcpy(buf + sizeof *gb, gb->mbc.ram, gb->mbc.save_size);
+}
+
+void gb_restore(gb_t *gb, const unsigned char *buf)
+{
+	gb_t *prev;
+
+	memcpy(gb, buf, sizeof *gb);
+	memcpy(gb->mbc.ram, buf + sizeof *gb, gb->mbc.save_size);
+
+	/* RAM may no longer hold what its blocks were decoded from */
+	prev = gb_select(gb);
+	cpu_invalidate_ram();
+	gb_select(prev);
+}
+
+/* Run a frame, then 'frames' more with the same input that are thrown
+ * away but for the picture of the last one. The game then reacts to
+ * input that many frames sooner. Only the real frame makes sound.
+ */
+int gb_run_ahead(gb_t *gb, unsigned int frames)
+{
+	unsigned int *framebuffer = gb->framebuffer;
+	unsigned int i;
+	int r;
+
+	if(!frames)
+		return gb_run_frame(gb);
+
+	if(!gb->ahead && !(gb->ahead = malloc(gb_snapshot_size(gb))))
+		return GB_ERROR;
+
+	gb->framebuffer = NULL;
+	r = gb_run_frame(gb);
+	if(r == GB_ERROR)
+	{
+		gb->framebuffer = framebuffer;
+		return r;
+	}
+
+	gb_snapshot(gb, gb->ahead);
+	gb->apu.out = NULL;
+
+	for(i = 0; i < frames; i++)
+	{
+		if(i == frames - 1)
+			gb->framebuffer = framebuffer;
+		if(gb_run_frame(gb) == GB_ERROR)
+			break;
+	}
+
+	gb_restore(gb, gb->ahead);
+	gb->framebuffer = framebuffer;
+
+	return r;
+}
+
+void gb_set_framebuffer(gb_t *gb, unsigned int *framebuffer)
+{
+	gb->framebuffer = framebuffer;
+}
+
+void gb_set_input(gb_t *gb, unsigned int buttons, unsigned int directions)
+{
+	gb->buttons = buttons;
+	gb->directions = directions;
+}
+
+unsigned int gb_get_frames(gb_t *gb)
+{
+	return gb->frames;
+}
+
+unsigned int gb_get_cycles(gb_t *gb)
+{
+	return gb->cpu.prev_cycles;
+}
+
+unsigned int gb_get_instructions(gb_t *gb)
+{
+	return gb->cpu.instructions;
+}
+
+/* Whether an MBC5 rumble cart has its motor on */
+int gb_get_rumble(gb_t *gb)
+{
+	return gb->mbc.rumble;
+}
+
+/* Hash of the 160x144 shades of the last finished frame, not affected by
+ * the framebuffer or the colours it's drawn in.
+ */
+unsigned long long gb_get_frame_hash(gb_t *gb)
+{
+	return gb->lcd.frame_hash;
+}
+
+/* What has been sent over the link port, the last 4KiB of it at most */
+const unsigned char *gb_get_serial(gb_t *gb, unsigned int *len)
+{
+	*len = gb->serial.captured;
+
+	return gb->serial.capture;
+}
+
+/* Where to put the samples, NULL skips synthesis and only keeps the sound
+ * registers right
+ */
+void gb_set_audio(gb_t *gb, struct ring *out)
+{
+	gb_t *prev = gb_select(gb);
+
+	apu_set_output(out);
+	gb_select(prev);
+}
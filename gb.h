@@ -0,0 +1,287 @@
+#ifndef GB_H
+#define GB_H
+#include "sched.h"
+
+/* Everything one emulated Game Boy owns. The modules work on whichever
+ * instance is in gb_current, which the gb_* calls below select.
+ */
+struct gb_rom {
+	unsigned char *bytes;
+	unsigned int size;	/* Of our own mapping, 0 if the ROM is shared */
+	unsigned int mapper;
+	unsigned int banks;	/* 16KiB ROM banks */
+	unsigned int ram_size;	/* Cartridge RAM from the header, in bytes */
+	int battery, rtc, rumble;
+};
+
+struct gb_cpu {
+	unsigned char H;
+	unsigned char L;
+
+	unsigned char D;
+	unsigned char E;
+
+	unsigned char B;
+	unsigned char C;
+
+	unsigned char A;
+	unsigned char F;
+
+	unsigned short SP;
+	unsigned short PC;
+	unsigned int cycles, prev_cycles;
+
+#ifdef LAZY_FLAGS
+	int lazy;	/* F is stale, work it out from the last ALU op */
+	int lz_op;
+	unsigned char lz_a, lz_b, lz_r;
+#endif
+
+	int halted;
+	int halt_bug;
+	unsigned int instructions;
+
+	struct cpu_cache *cache;	/* Decoded blocks, see cpu.c */
+};
+
+struct gb_mem {
+	/* Where each 4KiB region of the address space currently lives. ROM
+	 * regions point straight into the ROM, A000-BFFF into the cartridge
+	 * RAM bank or no_sram, everything else into ram.
+	 */
+	unsigned char *regions[16];
+	unsigned int rom_bank;
+
+	/* The same per 256-byte page, for reads. NULL where a read needs
+	 * mem_get_byte()'s slow path: page FF, and everything during OAM DMA.
+	 */
+	unsigned char *read_pages[256];
+
+	/* Who handles writes to each page, set up for the mapper by
+	 * mem_init(). NULL is a plain store to ram.
+	 */
+	void (*write_pages[256])(unsigned short, unsigned char);
+
+	int dma_pending;
+	int joypad_select_buttons, joypad_select_directions;
+
+	/* What A000-BFFF shows with no cartridge RAM enabled */
+	unsigned char no_sram[0x1000];
+
+	unsigned char ram[0x10000];
+};
+
+struct gb_mbc {
+	unsigned int bank_upper_bits;
+	unsigned int ram_select;
+
+	unsigned int rom_bank;	/* MBC5's 9 bit bank */
+
+	/* Cartridge RAM then the MBC3 clock, a mapping of the .sav file on
+	 * battery backed carts.
+	 */
+	unsigned char *ram;
+	unsigned int ram_size;	/* At least one 8KiB bank, if any */
+	unsigned int save_size;
+	int ram_mapped;
+	int ram_enabled;
+	unsigned int ram_bank;
+
+	unsigned char *rtc;	/* Inside ram, NULL without a clock */
+	int rtc_select;		/* 08-0C with a clock register in A000-BFFF */
+	int rtc_latch;
+	unsigned char rtc_page[0x2000];	/* What A000-BFFF shows then */
+
+	int rumble;
+};
+
+struct gb_interrupt {
+	int enabled;
+	int IF;	/* Pending interrupt flags */
+	int IE;	/* Interrupt masks */
+};
+
+struct gb_timer {
+	unsigned int time;	/* First cycle not yet accounted for */
+	unsigned int elapsed;
+	unsigned int ticks;
+
+	unsigned char tac;
+	unsigned int started;
+	unsigned int speed;
+	unsigned int counter;
+	unsigned int divider;
+	unsigned int modulo;
+};
+
+struct gb_serial {
+	unsigned char data;	/* SB, FF01 */
+	unsigned char control;	/* SC, FF02, transfer start and clock bits */
+
+	/* Every byte the game has sent */
+	unsigned char capture[0x1000];
+	unsigned int captured;
+};
+
+#define APU_BUF 2048	/* Samples synthesised between trips to the ring */
+#define APU_KERNEL 16	/* Taps of the band-limited step */
+
+struct apu_channel {
+	int enabled;	/* Playing, as NR52 shows it */
+	int dac;
+	unsigned int length;	/* Length clocks left */
+	int volume;
+	int env_timer;
+
+	unsigned int period;	/* Cycles per waveform step, 0 for none */
+	unsigned int next;	/* Cycle of the next step */
+	unsigned int pos;	/* Duty or wave position */
+	int left, right;	/* What it adds to each side at the moment */
+};
+
+struct gb_apu {
+	unsigned char regs[0x30];	/* FF10-FF3F */
+	struct apu_channel ch[4];
+	int power;
+	unsigned int time;	/* First cycle not yet accounted for */
+	unsigned int seq_next;	/* Next 512Hz frame sequencer step */
+	int seq_step;
+
+	int sweep_enabled, sweep_timer;
+	unsigned int shadow;	/* Channel 1 frequency the sweep works on */
+	unsigned int lfsr;
+
+	/* Synthesis, only done with somewhere to put the samples. buf holds
+	 * the amplitude changes of each side as band-limited steps, sample 0
+	 * being at cycle buf_time plus buf_frac/65536 of a sample.
+	 */
+	struct ring *out;
+	unsigned int buf_time, buf_frac;
+	int sum[2];
+	int kernel[32][APU_KERNEL];
+	int buf[2][APU_BUF + APU_KERNEL];
+};
+
+struct sprite {
+	int y, x, tile, flags;
+};
+
+struct oam_cache
+{
+	char colour;
+	char prio;
+	char pal;
+};
+
+struct gb_lcd {
+	int next_line, next_dot;
+	unsigned int time;	/* Timestamp of the dot at next_line, next_dot */
+	int line, prev_line;
+	int ly_compare;
+
+	/* LCD STAT */
+	int ly_int;	/* LYC = LY coincidence interrupt enable */
+	int oam_int;
+	int vblank_int;
+	int hblank_int;
+	int mode;
+
+	/* LCD Control */
+	int enabled;
+	int window_tilemap_select;
+	int window_enabled;
+	int tilemap_select;
+	int bg_tiledata_select;
+	int sprite_size;
+	int sprites_enabled;
+	int bg_enabled;
+	int scroll_x, scroll_y;
+	int window_x, window_y;
+
+	int bgpalette[4];
+	int sprpalette1[4];
+	int sprpalette2[4];
+
+	/* Carried from mode 2 to the end of mode 3, and across lines */
+	struct oam_cache line_oam[160];
+	int line_oam_clear;	/* Nothing in line_oam, no need to clear it */
+	int window_lines;
+	unsigned char scx_low_latch;
+
+	/* Every tile in 8000-97FF decoded to 2-bit colour indices, plain and
+	 * mirrored for HFLIP sprites. Kept up to date by lcd_write_tile().
+	 */
+	unsigned char tile_pixels[2][384][8][8];
+
+	/* OAM as kept up to date by lcd_write_oam(), and the sprites drawn on
+	 * each line, in drawing order. The lists are rebuilt when a sprite
+	 * moves or the sprite size changes.
+	 */
+	struct sprite oam[40];
+	unsigned char line_sprites[144][10];
+	unsigned char line_sprite_count[144];
+	int sprites_dirty;
+
+	/* FNV-1a over the shades of the lines drawn so far this frame, and
+	 * of the whole of the last frame.
+	 */
+	unsigned long long hash;
+	unsigned long long frame_hash;
+};
+
+struct gb_sched {
+	unsigned int when[EVENT_MAX];
+	int pending[EVENT_MAX];
+	unsigned int next_event;
+};
+
+/* The small, busy parts first, the big arrays last */
+typedef struct gb {
+	unsigned int *framebuffer;	/* 640x480, NULL draws nothing */
+	unsigned int frames;
+	int frame_done;
+	unsigned int buttons, directions;
+	unsigned char *ahead;	/* gb_run_ahead()'s snapshot, made on first use */
+
+	struct gb_rom rom;
+	struct gb_cpu cpu;
+	struct gb_sched sched;
+	struct gb_interrupt interrupt;
+	struct gb_timer timer;
+	struct gb_serial serial;
+	struct gb_apu apu;
+	struct gb_mbc mbc;
+	struct gb_mem mem;
+	struct gb_lcd lcd;
+} gb_t;
+
+extern __thread gb_t *gb_current;
+
+/* What gb_run_frame() and gb_run_until() stopped for */
+enum {
+	GB_ERROR,
+	GB_FRAME,
+	GB_CYCLES
+};
+
+gb_t *gb_create(const char *);
+gb_t *gb_create_shared(unsigned char *, unsigned int);
+void gb_destroy(gb_t *);
+gb_t *gb_select(gb_t *);
+int gb_run_frame(gb_t *);
+int gb_run_until(gb_t *, unsigned int);
+int gb_run_ahead(gb_t *, unsigned int);
+unsigned int gb_snapshot_size(gb_t *);
+void gb_snapshot(gb_t *, unsigned char *);
+void gb_restore(gb_t *, const unsigned char *);
+void gb_set_framebuffer(gb_t *, unsigned int *);
+void gb_set_input(gb_t *, unsigned int, unsigned int);
+unsigned int gb_get_frames(gb_t *);
+unsigned int gb_get_cycles(gb_t *);
+unsigned int gb_get_instructions(gb_t *);
+int gb_get_rumble(gb_t *);
+unsigned long long gb_get_frame_hash(gb_t *);
+const unsigned char *gb_get_serial(gb_t *, unsigned int *);
+struct ring;
+void gb_set_audio(gb_t *, struct ring *);
+#endif
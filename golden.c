@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "golden.h"
+
+/* Golden lists are text, one "frame hash" line per frame with the hash in
+ * hex. Frames missing from the list aren't checked. Lines starting with #
+ * are comments.
+ */
+int golden_load(struct golden *g, const char *filename)
+{
+	char line[256];
+	FILE *f;
+
+	memset(g, 0, sizeof *g);
+
+	f = fopen(filename, "r");
+	if(!f)
+		return 0;
+
+	while(fgets(line, sizeof line, f))
+	{
+		struct frame_hash e;
+		char *tok = strtok(line, " \t\r\n");
+
+		if(!tok || tok[0] == '#')
+			continue;
+
+		e.frame = strtoul(tok, NULL, 0);
+
+		tok = strtok(NULL, " \t\r\n");
+		if(!tok)
+		{
+			fprintf(stderr, "%s: no hash for frame %u\n", filename, e.frame);
+			continue;
+		}
+		e.hash = strtoull(tok, NULL, 16);
+
+		g->hashes = realloc(g->hashes, (g->count + 1) * sizeof *g->hashes);
+		g->hashes[g->count++] = e;
+	}
+
+	fclose(f);
+
+	return 1;
+}
+
+/* Returns 0 if 'hash' isn't what the list has for 'frame', with the
+ * expected hash in 'expected'. Frames have to come in order.
+ */
+int golden_check(struct golden *g, unsigned int frame, unsigned long long hash, unsigned long long *expected)
+{
+	while(g->next < g->count && g->hashes[g->next].frame < frame)
+		g->next++;
+
+	if(g->next == g->count || g->hashes[g->next].frame != frame)
+		return 1;
+
+	*expected = g->hashes[g->next].hash;
+
+	return hash == *expected;
+}
+
+int golden_record(struct golden *g, const char *filename)
+{
+	memset(g, 0, sizeof *g);
+
+	g->out = fopen(filename, "w");
+
+	return g->out != NULL;
+}
+
+void golden_write(struct golden *g, unsigned int frame, unsigned long long hash)
+{
+	fprintf(g->out, "%u %016llx\n", frame, hash);
+}
+
+void golden_close(struct golden *g)
+{
+	if(g->out)
+		fclose(g->out);
+
+	free(g->hashes);
+	memset(g, 0, sizeof *g);
+}
@@ -0,0 +1,24 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+#include <stdio.h>
+
+/* What gb_get_frame_hash() gave after 'frame' */
+struct frame_hash {
+	unsigned int frame;
+	unsigned long long hash;
+};
+
+struct golden {
+	struct frame_hash *hashes;
+	unsigned int count;
+	unsigned int next;	/* Next hash to check */
+
+	FILE *out;	/* Recording to */
+};
+
+int golden_load(struct golden *, const char *);
+int golden_check(struct golden *, unsigned int, unsigned long long, unsigned long long *);
+int golden_record(struct golden *, const char *);
+void golden_write(struct golden *, unsigned int, unsigned long long);
+void golden_close(struct golden *);
+#endif
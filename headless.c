@@ -0,0 +1,55 @@
+#include <stdlib.h>
+#include "sdl.h"
+
+/* Framebuffer-only video backend for builds without SDL. Nothing is
+ * displayed, no input is read and frames are never paced.
+ */
+static unsigned int *framebuffer;
+static unsigned int frames;
+
+void sdl_init(int no_window)
+{
+	(void) no_window;
+	framebuffer = calloc(640*480, sizeof *framebuffer);
+}
+
+int sdl_update(void)
+{
+	return 0;
+}
+
+unsigned int sdl_get_buttons(void)
+{
+	return 0;
+}
+
+unsigned int sdl_get_directions(void)
+{
+	return 0;
+}
+
+unsigned int *sdl_get_framebuffer(void)
+{
+	return framebuffer;
+}
+
+/* No sound, the APU only keeps its registers right */
+struct ring *sdl_get_audio(void)
+{
+	return NULL;
+}
+
+unsigned int sdl_get_frames(void)
+{
+	return frames;
+}
+
+void sdl_frame(void)
+{
+	frames++;
+}
+
+void sdl_quit(void)
+{
+	free(framebuffer);
+}
@@ -1,17 +1,25 @@
 #include "interrupt.h"
 #include "cpu.h"
+#include "state.h"
+#include "gb.h"
 
-static int enabled;
+#define intr (gb_current->interrupt)
 
-/* Pending interrupt flags */
-static int interrupt_IF = 0xE0;
+void interrupt_init(void)
+{
+	intr.IF = 0xE0;
+}
 
-/* Interrupt masks */
-static int interrupt_IE = 0;
+void interrupt_state(struct state *s)
+{
+	STATE_VAR(s, intr.enabled);
+	STATE_VAR(s, intr.IF);
+	STATE_VAR(s, intr.IE);
+}
 
 int interrupt_pending(void)
 {
-	return interrupt_IF & interrupt_IE & 0x1F;
+	return intr.IF & intr.IE & 0x1F;
 }
 
 void interrupt_flush(void)
@@ -23,7 +31,7 @@ void interrupt_flush(void)
 	if(!pending)
 		return;
 
-	if(!enabled)
+	if(!intr.enabled)
 	{
 		if(cpu_halted())
 			cpu_unhalt();
@@ -37,27 +45,27 @@ void interrupt_flush(void)
 
 	if(pending & INTR_VBLANK)
 	{
-		interrupt_IF ^= INTR_VBLANK;
+		intr.IF ^= INTR_VBLANK;
 		cpu_interrupt(0x40);
 	}
 	else if(pending & INTR_LCDSTAT)
 	{
-		interrupt_IF ^= INTR_LCDSTAT;
+		intr.IF ^= INTR_LCDSTAT;
 		cpu_interrupt(0x48);
 	}
 	else if(pending & INTR_TIMER)
 	{
-		interrupt_IF ^= INTR_TIMER;
+		intr.IF ^= INTR_TIMER;
 		cpu_interrupt(0x50);
 	}
 	else if(pending & INTR_SERIAL)
 	{
-		interrupt_IF ^= INTR_SERIAL;
+		intr.IF ^= INTR_SERIAL;
 		cpu_interrupt(0x58);
 	}
 	else if(pending & INTR_JOYPAD)
 	{
-		interrupt_IF ^= INTR_JOYPAD;
+		intr.IF ^= INTR_JOYPAD;
 		cpu_interrupt(0x60);
 	}
 	else
@@ -68,45 +76,45 @@ void interrupt_flush(void)
 
 int interrupt_enabled(void)
 {
-	return enabled;
+	return intr.enabled;
 }
 
 void interrupt_enable(void)
 {
-	enabled = 1;
+	intr.enabled = 1;
 }
 
 void interrupt_disable(void)
 {
-	enabled = 0;
+	intr.enabled = 0;
 }
 
 int interrupt_get_enabled(void)
 {
-	return enabled;
+	return intr.enabled;
 }
 
 void interrupt(unsigned int n)
 {
-	interrupt_IF |= n;
+	intr.IF |= n;
 }
 
 unsigned char interrupt_get_IF(void)
 {
-	return interrupt_IF;
+	return intr.IF;
 }
 
 void interrupt_set_IF(unsigned char mask)
 {
-	interrupt_IF = 0xE0 | mask;
+	intr.IF = 0xE0 | mask;
 }
 
 unsigned char interrupt_get_mask(void)
 {
-	return interrupt_IE;
+	return intr.IE;
 }
 
 void interrupt_set_mask(unsigned char mask)
 {
-	interrupt_IE = mask;
+	intr.IE = mask;
 }
@@ -1,6 +1,7 @@
 #ifndef INTERRUPT_H
 #define INTERRUPT_H
 
+void interrupt_init(void);
 void interrupt(unsigned int);
 void interrupt_disable(void);
 void interrupt_enable(void);
@@ -12,6 +13,8 @@ void interrupt_flush(void);
 unsigned short interrupt_vector_for(int);
 int interrupt_get_enabled(void);
 int interrupt_pending(void);
+struct state;
+void interrupt_state(struct state *);
 
 enum {
 	INTR_VBLANK  = 0x01,
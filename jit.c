@@ -0,0 +1,402 @@
+#define _DEFAULT_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+#include "cpu.h"
+#include "gb.h"
+
+#ifdef JIT
+#if !defined(__x86_64__) && !defined(_M_X64)
+#error "The JIT only emits x86-64"
+#endif
+#ifdef LAZY_FLAGS
+#error "JIT code works F out as it goes, build it with CPU_FLAGS=eager"
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+/* Translates decoded blocks into x86-64. The cpu's registers stay in
+ * struct gb_cpu, rbx points at it, r12 at a table turning LAHF's flags
+ * into F's, and r13 at the next event's cycle. Plain loads and register
+ * ALU ops are done inline; everything else, anything touching memory
+ * included, is handed back to the interpreter one op at a time. PC,
+ * the cycle counter and the instruction count are only written back
+ * before those calls and wherever the block is left.
+ */
+#define JIT_SIZE (1<<20)
+#define JIT_BLOCK_MAX 4096	/* More than 16 ops could ever need */
+
+#define R(x) offsetof(struct gb_cpu, x)
+
+/* Every register has to be in reach of a signed 8-bit displacement */
+typedef char jit_disp8_check[R(instructions) < 0x80 ? 1 : -1];
+
+struct jit {
+	unsigned char *mem;
+	unsigned int used;
+	unsigned int *next;
+	unsigned char flags[256];	/* AH after LAHF to Z, H and C */
+};
+
+struct emit {
+	unsigned char *p;
+	unsigned int pc, cycles, instructions;	/* Not yet added to the cpu */
+};
+
+/* The 8-bit registers in opcode order, (HL) has no offset */
+static const unsigned char reg_off[8] = {R(B), R(C), R(D), R(E), R(H), R(L), 0, R(A)};
+
+/* ADD ADC SUB SBC AND XOR OR CP, as 'op al, [rbx+d8]' and 'op al, imm8' */
+static const unsigned char alu_rm[8] = {0x02, 0x12, 0x2A, 0x1A, 0x22, 0x32, 0x0A, 0x3A};
+static const unsigned char alu_imm[8] = {0x04, 0x14, 0x2C, 0x1C, 0x24, 0x34, 0x0C, 0x3C};
+
+#define EMIT(e, ...) emit_bytes(e, (const unsigned char []){__VA_ARGS__}, sizeof((const unsigned char []){__VA_ARGS__}))
+
+static void emit_bytes(struct emit *e, const unsigned char *b, unsigned int n)
+{
+	memcpy(e->p, b, n);
+	e->p += n;
+}
+
+static void emit32(struct emit *e, unsigned int v)
+{
+	EMIT(e, v, v>>8, v>>16, v>>24);
+}
+
+static void emit64(struct emit *e, unsigned long long v)
+{
+	emit32(e, v);
+	emit32(e, v>>32);
+}
+
+static void emit_epilogue(struct emit *e)
+{
+	EMIT(e, 0x48, 0x83, 0xC4, 0x20);	/* add rsp, 32 */
+	EMIT(e, 0x41, 0x5D);			/* pop r13 */
+	EMIT(e, 0x41, 0x5C);			/* pop r12 */
+	EMIT(e, 0x5B);				/* pop rbx */
+	EMIT(e, 0xC3);				/* ret */
+}
+
+/* Write back what the ops so far have done to PC and the counters */
+static void emit_sync(struct emit *e)
+{
+	if(e->pc)
+		EMIT(e, 0x66, 0x81, 0x43, R(PC), e->pc, e->pc>>8);	/* add word [rbx+PC], imm16 */
+
+	if(e->cycles)
+	{
+		EMIT(e, 0x81, 0x43, R(cycles));				/* add dword [rbx+cycles], imm32 */
+		emit32(e, e->cycles);
+		EMIT(e, 0x8B, 0x43, R(cycles));				/* mov eax, [rbx+cycles] */
+		EMIT(e, 0x89, 0x43, R(prev_cycles));			/* mov [rbx+prev_cycles], eax */
+	}
+
+	if(e->instructions)
+		EMIT(e, 0x83, 0x43, R(instructions), e->instructions);	/* add dword [rbx+instructions], imm8 */
+}
+
+/* Leave the block, as the interpreter would, if the next event is due */
+static void emit_check(struct emit *e)
+{
+	unsigned char *skip;
+
+	EMIT(e, 0x8B, 0x43, R(cycles));		/* mov eax, [rbx+cycles] */
+	if(e->cycles)
+	{
+		EMIT(e, 0x05);			/* add eax, imm32 */
+		emit32(e, e->cycles);
+	}
+	EMIT(e, 0x41, 0x2B, 0x45, 0x00);	/* sub eax, [r13] */
+	EMIT(e, 0x85, 0xC0);			/* test eax, eax */
+	EMIT(e, 0x7E, 0x00);			/* jle skip */
+	skip = e->p;
+
+	emit_sync(e);
+	EMIT(e, 0xB8);				/* mov eax, 1 */
+	emit32(e, 1);
+	emit_epilogue(e);
+
+	skip[-1] = e->p - skip;
+}
+
+/* Run one op through cpu_jit_op() or cpu_jit_mem(), leaving the block
+ * with what it returned unless that was 2
+ */
+static void emit_call(struct emit *e, unsigned long long f, const void *a, const void *b)
+{
+	unsigned char *skip;
+
+	emit_sync(e);
+	e->pc = e->cycles = e->instructions = 0;
+
+#ifdef _WIN32
+	EMIT(e, 0x48, 0xB9);			/* mov rcx, imm64 */
+	emit64(e, (size_t)a);
+	EMIT(e, 0x48, 0xBA);			/* mov rdx, imm64 */
+	emit64(e, (size_t)b);
+#else
+	EMIT(e, 0x48, 0xBF);			/* mov rdi, imm64 */
+	emit64(e, (size_t)a);
+	EMIT(e, 0x48, 0xBE);			/* mov rsi, imm64 */
+	emit64(e, (size_t)b);
+#endif
+	EMIT(e, 0x48, 0xB8);			/* mov rax, imm64 */
+	emit64(e, f);
+	EMIT(e, 0xFF, 0xD0);			/* call rax */
+
+	EMIT(e, 0x83, 0xF8, 0x02);		/* cmp eax, 2 */
+	EMIT(e, 0x74, 0x00);			/* je skip */
+	skip = e->p;
+	emit_epilogue(e);
+	skip[-1] = e->p - skip;
+}
+
+/* F from the flags of the x86 op just done. N is set from 'n', the bits
+ * in 'keep' are kept from the old F.
+ */
+static void emit_flags(struct emit *e, unsigned char n, unsigned char mask, unsigned char keep)
+{
+	EMIT(e, 0x9F);				/* lahf */
+	EMIT(e, 0x0F, 0xB6, 0xCC);		/* movzx ecx, ah */
+	EMIT(e, 0x41, 0x0F, 0xB6, 0x0C, 0x0C);	/* movzx ecx, byte [r12+rcx] */
+	if(mask != 0xFF)
+		EMIT(e, 0x80, 0xE1, mask);	/* and cl, mask */
+	if(n)
+		EMIT(e, 0x80, 0xC9, n);		/* or cl, n */
+	EMIT(e, 0x8A, 0x53, R(F));		/* mov dl, [rbx+F] */
+	EMIT(e, 0x80, 0xE2, keep);		/* and dl, keep */
+	EMIT(e, 0x08, 0xD1);			/* or cl, dl */
+}
+
+static void emit_alu(struct emit *e, int k, int src, unsigned char imm)
+{
+	EMIT(e, 0x8A, 0x43, R(A));		/* mov al, [rbx+A] */
+
+	/* ADC and SBC take C in x86's carry */
+	if(k == 1 || k == 3)
+	{
+		EMIT(e, 0x8A, 0x4B, R(F));	/* mov cl, [rbx+F] */
+		EMIT(e, 0xC0, 0xE9, 0x05);	/* shr cl, 5 */
+	}
+
+	if(src >= 0)
+		EMIT(e, alu_rm[k], 0x43, reg_off[src]);	/* op al, [rbx+r] */
+	else
+		EMIT(e, alu_imm[k], imm);		/* op al, imm8 */
+
+	if(k >= 4 && k <= 6)
+	{
+		/* AND, XOR and OR leave x86's AF undefined, only Z is wanted */
+		EMIT(e, 0x0F, 0x94, 0xC1);	/* setz cl */
+		EMIT(e, 0xC0, 0xE1, 0x07);	/* shl cl, 7 */
+		if(k == 4)
+			EMIT(e, 0x80, 0xC9, 0x20);	/* or cl, 0x20 */
+		EMIT(e, 0x8A, 0x53, R(F));	/* mov dl, [rbx+F] */
+		EMIT(e, 0x80, 0xE2, 0x0F);	/* and dl, 0x0F */
+		EMIT(e, 0x08, 0xD1);		/* or cl, dl */
+	}
+	else
+		emit_flags(e, (k == 2 || k == 3 || k == 7) ? 0x40 : 0, 0xFF, 0x0F);
+
+	EMIT(e, 0x88, 0x4B, R(F));		/* mov [rbx+F], cl */
+	if(k != 7)
+		EMIT(e, 0x88, 0x43, R(A));	/* mov [rbx+A], al */
+}
+
+/* BC, DE, HL as low and high byte offsets */
+static void emit_pair(struct emit *e, int rr, int dec)
+{
+	unsigned char hi = reg_off[rr*2], lo = reg_off[rr*2+1];
+
+	if(rr == 3)
+	{
+		EMIT(e, 0x66, 0xFF, dec ? 0x4B : 0x43, R(SP));	/* inc/dec word [rbx+SP] */
+		return;
+	}
+
+	EMIT(e, 0x8A, 0x43, lo);		/* mov al, [rbx+lo] */
+	EMIT(e, 0x8A, 0x63, hi);		/* mov ah, [rbx+hi] */
+	EMIT(e, 0x66, 0xFF, dec ? 0xC8 : 0xC0);	/* inc/dec ax */
+	EMIT(e, 0x88, 0x43, lo);		/* mov [rbx+lo], al */
+	EMIT(e, 0x88, 0x63, hi);		/* mov [rbx+hi], ah */
+}
+
+/* Emit an op inline if it's one of the simple ones. The cycles are the
+ * ones cpu.c charges for it.
+ */
+static int emit_op(struct emit *e, const struct cpu_op *op)
+{
+	unsigned char b = op->opcode;
+	int dst = (b>>3)&7, src = b&7, len = 1, cycles = 1;
+
+	if(b == 0x00)	/* NOP */
+		;
+	else if(b >= 0x40 && b < 0x80 && b != 0x76)	/* LD r, r */
+	{
+		if(dst == 6 || src == 6)
+			return 0;
+		EMIT(e, 0x8A, 0x43, reg_off[src]);	/* mov al, [rbx+src] */
+		EMIT(e, 0x88, 0x43, reg_off[dst]);	/* mov [rbx+dst], al */
+	}
+	else if(b >= 0x80 && b < 0xC0)	/* ALU A, r */
+	{
+		if(src == 6)
+			return 0;
+		emit_alu(e, dst, src, 0);
+	}
+	else if((b & 0xC7) == 0xC6)	/* ALU A, imm8 */
+	{
+		emit_alu(e, dst, -1, op->imm);
+		len = cycles = 2;
+	}
+	else if((b & 0xC7) == 0x06 && dst != 6)	/* LD r, imm8 */
+	{
+		EMIT(e, 0xC6, 0x43, reg_off[dst], op->imm);	/* mov byte [rbx+r], imm8 */
+		len = cycles = 2;
+	}
+	else if((b & 0xC7) == 0x04 || (b & 0xC7) == 0x05)	/* INC r, DEC r */
+	{
+		if(dst == 6)
+			return 0;
+		EMIT(e, 0x8A, 0x43, reg_off[dst]);		/* mov al, [rbx+r] */
+		EMIT(e, 0xFE, b & 1 ? 0xC8 : 0xC0);		/* inc/dec al */
+		emit_flags(e, b & 1 ? 0x40 : 0, 0xA0, 0x1F);
+		EMIT(e, 0x88, 0x4B, R(F));			/* mov [rbx+F], cl */
+		EMIT(e, 0x88, 0x43, reg_off[dst]);		/* mov [rbx+r], al */
+	}
+	else if((b & 0xCF) == 0x01)	/* LD rr, imm16 */
+	{
+		if(b == 0x31)
+			EMIT(e, 0x66, 0xC7, 0x43, R(SP), op->imm, op->imm>>8);	/* mov word [rbx+SP], imm16 */
+		else
+		{
+			EMIT(e, 0xC6, 0x43, reg_off[(b>>4)*2], op->imm>>8);
+			EMIT(e, 0xC6, 0x43, reg_off[(b>>4)*2+1], op->imm);
+		}
+		len = cycles = 3;
+	}
+	else if((b & 0xC7) == 0x03)	/* INC rr, DEC rr */
+	{
+		emit_pair(e, b>>4, b & 8);
+		cycles = 2;
+	}
+	else
+		return 0;
+
+	e->pc += len;
+	e->cycles += cycles;
+	e->instructions++;
+
+	return 1;
+}
+
+struct jit *jit_create(unsigned int *next)
+{
+	struct jit *jit = calloc(1, sizeof *jit);
+	int i;
+
+	if(!jit)
+		return NULL;
+
+#ifdef _WIN32
+	jit->mem = VirtualAlloc(NULL, JIT_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	jit->mem = mmap(NULL, JIT_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(jit->mem == MAP_FAILED)
+		jit->mem = NULL;
+#endif
+	if(!jit->mem)
+	{
+		free(jit);
+		return NULL;
+	}
+
+	/* LAHF puts ZF in bit 6, AF in bit 4 and CF in bit 0 */
+	for(i = 0; i < 256; i++)
+		jit->flags[i] = (i & 0x40 ? 0x80 : 0) | (i & 0x10 ? 0x20 : 0) | (i & 0x01 ? 0x10 : 0);
+
+	jit->next = next;
+
+	return jit;
+}
+
+void jit_destroy(struct jit *jit)
+{
+	if(!jit)
+		return;
+
+#ifdef _WIN32
+	VirtualFree(jit->mem, 0, MEM_RELEASE);
+#else
+	munmap(jit->mem, JIT_SIZE);
+#endif
+	free(jit);
+}
+
+/* Throw away all the code, anything from jit_compile() is no longer valid */
+void jit_reset(struct jit *jit)
+{
+	jit->used = 0;
+}
+
+/* Translate 'count' ops of 'blk'. NULL when out of room. The code returns
+ * what cpu_run() should: 0 for an unhandled op, else 1.
+ */
+jit_code jit_compile(struct jit *jit, const struct cpu_block *blk, const struct cpu_op *ops, unsigned int count)
+{
+	struct emit e = {jit->mem + jit->used, 0, 0, 0};
+	unsigned char *start = e.p;
+	jit_code code;
+	unsigned int i;
+
+	if(jit->used + JIT_BLOCK_MAX > JIT_SIZE)
+		return NULL;
+
+	EMIT(&e, 0x53);				/* push rbx */
+	EMIT(&e, 0x41, 0x54);			/* push r12 */
+	EMIT(&e, 0x41, 0x55);			/* push r13 */
+	EMIT(&e, 0x48, 0x83, 0xEC, 0x20);	/* sub rsp, 32 */
+	EMIT(&e, 0x48, 0xBB);			/* mov rbx, imm64 */
+	emit64(&e, (size_t)&gb_current->cpu);
+	EMIT(&e, 0x49, 0xBC);			/* mov r12, imm64 */
+	emit64(&e, (size_t)jit->flags);
+	EMIT(&e, 0x49, 0xBD);			/* mov r13, imm64 */
+	emit64(&e, (size_t)jit->next);
+
+	for(i = 0; i < count; i++)
+	{
+		/* The interpreter checks the time before each op, except after
+		 * one that touched memory, which cpu_jit_mem() already did
+		 */
+		if(i && !(ops[i-1].flags & OP_MEM))
+			emit_check(&e);
+
+		if(emit_op(&e, &ops[i]))
+			continue;
+
+		if((ops[i].flags & OP_MEM) && i < count - 1)
+			emit_call(&e, (size_t)cpu_jit_mem, &ops[i], blk);
+		else
+			emit_call(&e, (size_t)cpu_jit_op, &ops[i], blk);
+	}
+
+	emit_sync(&e);
+	EMIT(&e, 0xB8);				/* mov eax, 1 */
+	emit32(&e, 1);
+	emit_epilogue(&e);
+
+	jit->used += e.p - start;
+	*(void **)&code = start;
+
+	return code;
+}
+#endif
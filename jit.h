@@ -0,0 +1,11 @@
+#ifndef JIT_H
+#define JIT_H
+struct jit;
+struct cpu_op;
+struct cpu_block;
+typedef int (*jit_code)(void);
+struct jit *jit_create(unsigned int *);
+void jit_destroy(struct jit *);
+void jit_reset(struct jit *);
+jit_code jit_compile(struct jit *, const struct cpu_block *, const struct cpu_op *, unsigned int);
+#endif
@@ -1,43 +1,19 @@
 #include "lcd.h"
 #include "cpu.h"
 #include "interrupt.h"
-#include "sdl.h"
 #include "mem.h"
+#include "sched.h"
+#include "state.h"
+#include "gb.h"
 
-#include <assert.h>
 #include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-static int lcd_cycles;
-static int lcd_line, prev_line;
-static int lcd_ly_compare;
-
-/* LCD STAT */
-static int ly_int;	/* LYC = LY coincidence interrupt enable */
-static int oam_int;
-static int vblank_int;
-static int hblank_int;
-static int lcd_mode;
-
-/* LCD Control */
-static int lcd_enabled;
-static int window_tilemap_select;
-static int window_enabled;
-static int tilemap_select;
-static int bg_tiledata_select;
-static int sprite_size;
-static int sprites_enabled;
-static int bg_enabled;
-static int scroll_x, scroll_y;
-static int window_x, window_y;
-
-static int bgpalette[] = {0, 3, 3, 3};
-static int sprpalette1[] = {0, 1, 2, 3};
-static int sprpalette2[] = {0, 1, 2, 3};
-static unsigned long colours[4] = {0xF4FFF4, 0xC0D0C0, 0x80A080, 0x001000};
-
-struct sprite {
-	int y, x, tile, flags;
-};
+#define lcd (gb_current->lcd)
+
+static unsigned int colours[4] = {0xF4FFF4, 0xC0D0C0, 0x80A080, 0x001000};
 
 enum {
 	PRIO  = 0x80,
@@ -46,201 +22,301 @@ enum {
 	PNUM  = 0x10
 };
 
+/* Every other dot leaves the PPU state alone, so only these need running:
+ * the start of each line, and the mode 2 to 3 and 3 to 0 changes on
+ * visible lines.
+ */
+static unsigned int lcd_next_dot(void)
+{
+	if(lcd.next_dot == 0)
+		return 0;
+
+	if(lcd.next_line < 144)
+	{
+		if(lcd.next_dot <= 80)
+			return 80 - lcd.next_dot;
+		if(lcd.next_dot <= 245)
+			return 245 - lcd.next_dot;
+	}
+
+	return 456 - lcd.next_dot;
+}
+
+static void lcd_schedule(void)
+{
+	sched_add(EVENT_LCD, lcd.time + lcd_next_dot());
+}
+
 void lcd_write_bg_palette(unsigned char n)
 {
-	bgpalette[0] = (n>>0)&3;
-	bgpalette[1] = (n>>2)&3;
-	bgpalette[2] = (n>>4)&3;
-	bgpalette[3] = (n>>6)&3;
+	lcd.bgpalette[0] = (n>>0)&3;
+	lcd.bgpalette[1] = (n>>2)&3;
+	lcd.bgpalette[2] = (n>>4)&3;
+	lcd.bgpalette[3] = (n>>6)&3;
 }
 
 void lcd_write_spr_palette1(unsigned char n)
 {
-	sprpalette1[0] = 0;
-	sprpalette1[1] = (n>>2)&3;
-	sprpalette1[2] = (n>>4)&3;
-	sprpalette1[3] = (n>>6)&3;
+	lcd.sprpalette1[0] = 0;
+	lcd.sprpalette1[1] = (n>>2)&3;
+	lcd.sprpalette1[2] = (n>>4)&3;
+	lcd.sprpalette1[3] = (n>>6)&3;
 }
 
 void lcd_write_spr_palette2(unsigned char n)
 {
-	sprpalette2[0] = 0;
-	sprpalette2[1] = (n>>2)&3;
-	sprpalette2[2] = (n>>4)&3;
-	sprpalette2[3] = (n>>6)&3;
+	lcd.sprpalette2[0] = 0;
+	lcd.sprpalette2[1] = (n>>2)&3;
+	lcd.sprpalette2[2] = (n>>4)&3;
+	lcd.sprpalette2[3] = (n>>6)&3;
 }
 
 void lcd_write_scroll_x(unsigned char n)
 {
-	scroll_x = n;
+	lcd.scroll_x = n;
 }
 
 void lcd_write_scroll_y(unsigned char n)
 {
-	scroll_y = n;
+	lcd.scroll_y = n;
 }
 
 int lcd_get_line(void)
 {
-	return lcd_line;
+	return lcd.line;
 }
 
 unsigned char lcd_get_stat(void)
 {
-	unsigned char coincidence = (lcd_line == lcd_ly_compare) << 2;
-	return 0x80 | ly_int | oam_int | vblank_int | hblank_int | coincidence | lcd_mode;
+	unsigned char coincidence = (lcd.line == lcd.ly_compare) << 2;
+	return 0x80 | lcd.ly_int | lcd.oam_int | lcd.vblank_int | lcd.hblank_int | coincidence | lcd.mode;
 }
 
 void lcd_write_stat(unsigned char c)
 {
-	ly_int     = c&0x40;
-	oam_int    = c&0x20;
-	vblank_int = c&0x10;
-	hblank_int = c&0x08;
+	lcd.ly_int     = c&0x40;
+	lcd.oam_int    = c&0x20;
+	lcd.vblank_int = c&0x10;
+	lcd.hblank_int = c&0x08;
 }
 
 void lcd_write_control(unsigned char c)
 {
 	/* LCD just got turned on */
-	if(!lcd_enabled && (c & 0x80))
-		lcd_cycles = 0;
-
-	bg_enabled            = !!(c & 0x01);
-	sprites_enabled       = !!(c & 0x02);
-	sprite_size           = !!(c & 0x04);
-	tilemap_select        = !!(c & 0x08);
-	bg_tiledata_select    = !!(c & 0x10);
-	window_enabled        = !!(c & 0x20);
-	window_tilemap_select = !!(c & 0x40);
-	lcd_enabled           = !!(c & 0x80);
+	if(!lcd.enabled && (c & 0x80))
+	{
+		lcd.next_line = lcd.next_dot = 0;
+		lcd.time = cpu_get_cycles();
+		lcd_schedule();
+	}
+
+	if(lcd.sprite_size != !!(c & 0x04))
+		lcd.sprites_dirty = 1;
+
+	lcd.bg_enabled            = !!(c & 0x01);
+	lcd.sprites_enabled       = !!(c & 0x02);
+	lcd.sprite_size           = !!(c & 0x04);
+	lcd.tilemap_select        = !!(c & 0x08);
+	lcd.bg_tiledata_select    = !!(c & 0x10);
+	lcd.window_enabled        = !!(c & 0x20);
+	lcd.window_tilemap_select = !!(c & 0x40);
+	lcd.enabled           = !!(c & 0x80);
 }
 
 unsigned char lcd_get_ly_compare(void)
 {
-	return lcd_ly_compare;
+	return lcd.ly_compare;
 }
 
 void lcd_set_ly_compare(unsigned char c)
 {
-	lcd_ly_compare = c;
+	lcd.ly_compare = c;
 }
 
 void lcd_set_window_y(unsigned char n) {
-	window_y = n;
+	lcd.window_y = n;
 }
 
 void lcd_set_window_x(unsigned char n) {
-	window_x = n;
+	lcd.window_x = n;
 }
 
-#define POKE(x, y, c) do { assert((x) <= 455); assert((y) < 154); \
-	b[(y)*2*640 + (x)*2] = (c); \
-	b[(y)*2*640 + (x)*2 + 1] = (c); \
-	b[((y)*2+1)*640 + (x)*2] = (c); \
-	b[((y)*2+1)*640 + (x)*2 + 1] = (c); \
-	} while(0)
+/* Re-decode the tile row containing VRAM address 'addr' */
+void lcd_write_tile(unsigned short addr)
+{
+	unsigned int tile = (addr - 0x8000)/16, row = (addr/2)%8, px;
+	unsigned char b1, b2;
+
+	b1 = mem_get_raw(addr & ~1);
+	b2 = mem_get_raw(addr | 1);
+
+	for(px = 0; px < 8; px++)
+	{
+		unsigned char c = ((b2>>(7-px))&1)<<1 | ((b1>>(7-px))&1);
+
+		lcd.tile_pixels[0][tile][row][px] = c;
+		lcd.tile_pixels[1][tile][row][7-px] = c;
+	}
+}
 
-static void swap(struct sprite *a, struct sprite *b)
+/* Re-read the sprite containing OAM address 'addr' */
+void lcd_write_oam(unsigned short addr)
 {
-	struct sprite c;
+	struct sprite *s = &lcd.oam[(addr - 0xFE00)/4];
+	int y, x;
+
+	addr &= ~3;
+	y = mem_get_raw(addr + 0) - 16;
+	x = mem_get_raw(addr + 1) - 8;
+
+	if(y != s->y || x != s->x)
+		lcd.sprites_dirty = 1;
 
-	 c = *a;
-	*a = *b;
-	*b =  c;
+	s->y     = y;
+	s->x     = x;
+	s->tile  = mem_get_raw(addr + 2);
+	s->flags = mem_get_raw(addr + 3);
 }
 
-static void sort_sprites(struct sprite *s, int n)
+/* Turn a line of shades (0-3) into colours, doubled in both directions
+ * on the 640x480 framebuffer.
+ */
+static void lcd_output_line(int line, const unsigned char *shades)
 {
-	int swapped, i;
+	unsigned int *row = gb_current->framebuffer;
+	int x = 0;
 
-	do
+	if(!row)
+		return;
+	row += line*2*640;
+
+#if defined(__AVX2__)
+	const __m256i pal = _mm256_setr_epi32(colours[0], colours[1], colours[2], colours[3],
+		colours[0], colours[1], colours[2], colours[3]);
+	const __m256i lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+	const __m256i hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+
+	for(; x < 160; x += 8)
 	{
-		swapped = 0;
-		for(i = 0; i < n-1; i++)
-		{
-			if(s[i].x > s[i+1].x)
-			{
-				swap(&s[i], &s[i+1]);
-				swapped = 1;
-			}
-		}
+		__m128i s = _mm_loadl_epi64((const __m128i *)&shades[x]);
+		__m256i c = _mm256_permutevar8x32_epi32(pal, _mm256_cvtepu8_epi32(s));
+		__m256i c1 = _mm256_permutevar8x32_epi32(c, lo);
+		__m256i c2 = _mm256_permutevar8x32_epi32(c, hi);
+
+		_mm256_storeu_si256((__m256i *)&row[x*2], c1);
+		_mm256_storeu_si256((__m256i *)&row[x*2 + 8], c2);
+		_mm256_storeu_si256((__m256i *)&row[640 + x*2], c1);
+		_mm256_storeu_si256((__m256i *)&row[640 + x*2 + 8], c2);
+	}
+#elif defined(__SSE2__)
+	for(; x < 160; x += 4)
+	{
+		__m128i c = _mm_setr_epi32(colours[shades[x]], colours[shades[x+1]],
+			colours[shades[x+2]], colours[shades[x+3]]);
+		__m128i c1 = _mm_unpacklo_epi32(c, c);
+		__m128i c2 = _mm_unpackhi_epi32(c, c);
+
+		_mm_storeu_si128((__m128i *)&row[x*2], c1);
+		_mm_storeu_si128((__m128i *)&row[x*2 + 4], c2);
+		_mm_storeu_si128((__m128i *)&row[640 + x*2], c1);
+		_mm_storeu_si128((__m128i *)&row[640 + x*2 + 4], c2);
 	}
-	while(swapped);
+#else
+	for(; x < 160; x++)
+		row[x*2] = row[x*2 + 1] = colours[shades[x]];
+
+	memcpy(&row[640], row, 320 * sizeof *row);
+#endif
 }
 
-static int sprites_update(int line, struct sprite *spr)
+#define HASH_SEED 0xCBF29CE484222325ULL
+#define HASH_PRIME 0x100000001B3ULL
+
+/* Fold a line of shades into the frame hash, 8 pixels at a time */
+static void lcd_hash_line(const unsigned char *shades)
 {
-	int i, c = 0;
+	unsigned long long h = lcd.hash, w;
+	int x;
 
-	for(i = 0; i < 40; i++)
+	for(x = 0; x < 160; x += 8)
 	{
-		int y;
+		memcpy(&w, &shades[x], sizeof w);
+		h = (h ^ w) * HASH_PRIME;
+	}
+
+	lcd.hash = h;
+}
+
+/* Each line gets the first 10 sprites in OAM order that cover it, sorted
+ * by x with ties left in OAM order.
+ */
+static void sprites_build(void)
+{
+	int i, line, height = lcd.sprite_size ? 16 : 8;
 
-		y = mem_get_raw(0xFE00 + (i*4) + 0) - 16;
+	memset(lcd.line_sprite_count, 0, sizeof lcd.line_sprite_count);
 
-		if(line < y || line >= y + 8 + (sprite_size*8))
-			continue;
+	for(i = 0; i < 40; i++)
+	{
+		struct sprite *s = &lcd.oam[i];
+		int start = s->y < 0 ? 0 : s->y;
+		int end = s->y + height > 144 ? 144 : s->y + height;
 
-		spr[c].y     = y;
-		spr[c].x     = mem_get_raw(0xFE00 + (i*4) + 1) - 8;
-		spr[c].tile  = mem_get_raw(0xFE00 + (i*4) + 2);
-		spr[c].flags = mem_get_raw(0xFE00 + (i*4) + 3);
-		c++;
-		if(c == 10)
+		for(line = start; line < end; line++)
 		{
-			break;
+			unsigned char *list = lcd.line_sprites[line];
+			int n = lcd.line_sprite_count[line];
+
+			if(n == 10)
+				continue;
+
+			for(; n && lcd.oam[list[n-1]].x > s->x; n--)
+				list[n] = list[n-1];
+			list[n] = i;
+			lcd.line_sprite_count[line]++;
 		}
 	}
 
-	if(c)
-		sort_sprites(spr, c);
-
-	return c;
+	lcd.sprites_dirty = 0;
 }
 
-struct oam_cache
-{
-	char colour;
-	char prio;
-	char pal;
-};
-
 static void sprite_fetch(int line, struct oam_cache *o)
 {
-	struct sprite spr[10];
 	int i, x, sprite_count;
 
-	/* Fetch up to 10 in-range sprites for this scanline */
-	sprite_count = sprites_update(line, spr);
+	if(lcd.sprites_dirty)
+		sprites_build();
+
+	sprite_count = lcd.line_sprite_count[line];
 
-	memset(o, 0, sizeof (struct oam_cache[160]));
+	if(!lcd.line_oam_clear)
+		memset(o, 0, sizeof (struct oam_cache[160]));
+	lcd.line_oam_clear = !sprite_count;
 
 	/* Copy sprite pixels to oam_cache */
 	for(i = 0; i < sprite_count; i++)
 	{
-		int sprite_line;
-		unsigned short tile_addr;
-		unsigned char b1, b2, mask;
+		struct sprite *spr = &lcd.oam[lcd.line_sprites[line][i]];
+		int sprite_line, tile;
+		unsigned char *pixels;
 
 		/* Sprite is too far right to ever render anything */
-		if(spr[i].x >= 160)
+		if(spr->x >= 160)
 			continue;
 
-		if(spr[i].flags & VFLIP)
-			sprite_line = (sprite_size ? 15 : 7) - (line - spr[i].y);
+		if(spr->flags & VFLIP)
+			sprite_line = (lcd.sprite_size ? 15 : 7) - (line - spr->y);
 		else
-			sprite_line = line - spr[i].y;
+			sprite_line = line - spr->y;
 
-		if(sprite_size)
-			tile_addr = 0x8000 + (spr[i].tile & 0xFE) * 16 + sprite_line * 2;
+		if(lcd.sprite_size)
+			tile = (spr->tile & 0xFE) + sprite_line/8;
 		else
-			tile_addr = 0x8000 + spr[i].tile * 16 + sprite_line * 2;
+			tile = spr->tile;
 
-		b1 = mem_get_raw(tile_addr);
-		b2 = mem_get_raw(tile_addr + 1);
+		pixels = lcd.tile_pixels[!!(spr->flags & HFLIP)][tile][sprite_line%8];
 
-
-		for(x = spr[i].x; x < spr[i].x + 8; x++)
+		for(x = spr->x; x < spr->x + 8; x++)
 		{
 			int relx, new_col;
 
@@ -252,161 +328,239 @@ static void sprite_fetch(int line, struct oam_cache *o)
 			if(x >= 160)
 				break;
 
-			relx = x - spr[i].x;
-
-			mask = spr[i].flags & HFLIP ? 128>>(7-relx) : 128>>relx;
-			new_col = (!!(b2&mask))<<1 | !!(b1&mask);
+			relx = x - spr->x;
+			new_col = pixels[relx];
 
 			if(!o[x].colour)
 				o[x].colour = new_col;
-			o[x].prio = spr[i].flags & PRIO;
-			o[x].pal = spr[i].flags & PNUM;
+			o[x].prio = spr->flags & PRIO;
+			o[x].pal = spr->flags & PNUM;
 		}
 	}
 }
 
-/* Process scanline 'line', cycle 'cycle' within that line */
-static void lcd_do_line(int line, int cycle)
+/* Copy the tile map row starting at map coordinate (xm, ym) into
+ * out[x] .. out[end-1], looking up each tile row once per 8 pixels.
+ */
+static void draw_tiles(unsigned char *out, int x, int end, int map_select, unsigned int xm, unsigned int ym)
 {
-	unsigned int *b = sdl_get_framebuffer();
-	static struct oam_cache o[160];
-	static int line_fill = 0, fetch_delay = 0, window_lines = 0, window_used = 0;
-	static unsigned char scx_low_latch = 0;
+	unsigned int map_addr, row;
 
-	if(fetch_delay)
-	{
-		fetch_delay--;
-		return;
-	}
+	map_addr = 0x9800 + map_select*0x400 + (ym/8)*32;
+	row = ym%8;
 
-	if(line >= 144)
+	while(x < end)
 	{
-		lcd_mode = 1;
-		window_lines =  0;
-		return;
-	}
+		unsigned int tile_num, tile, px;
+		unsigned char *pixels;
 
-	if(lcd_mode != 2 && cycle < 80)
-	{
-		lcd_mode = 2;
-		if(oam_int)
-			interrupt(INTR_LCDSTAT);
-	}
-	else
-		if(lcd_mode == 2 && cycle >= 80)
-		{
-			scx_low_latch = scroll_x & 7;
-			sprite_fetch(line, o);
-			lcd_mode = 3;
-		}
-
-	if(cycle < 86)
-		return;
-
-	if(lcd_mode == 3)
-	{
-		struct oam_cache *oc;
-		int colour = 0, bgcol;
-		unsigned int map_select, map_offset, tile_num, tile_addr, xm, ym;
-		unsigned char b1, b2, mask;
-
-		if(line >= window_y && window_enabled && line - window_y < 144 && (window_x - 7) <= line_fill)
-		{
-			xm = line_fill - (window_x-7);
-			ym = window_lines;
-			map_select = window_tilemap_select;
-			window_used = 1;
-		}
+		tile_num = mem_get_raw(map_addr + (xm/8)%32);
+		if(lcd.bg_tiledata_select)
+			tile = tile_num;
 		else
-		{
-			if(!bg_enabled)
-			{
-				bgcol = 0;
-				goto skip_bg;
-			}
-
-			xm = (line_fill + (scroll_x & 0xF8) + scx_low_latch)%256;
-			ym = (line + scroll_y)%256;
-			map_select = tilemap_select;
-		}
+			tile = 256 + (signed char)tile_num;
 
-		map_offset = (ym/8)*32 + xm/8;
+		pixels = lcd.tile_pixels[0][tile][row];
 
-		tile_num = mem_get_raw(0x9800 + map_select*0x400 + map_offset);
-		if(bg_tiledata_select)
-			tile_addr = 0x8000 + tile_num*16;
-		else
-			tile_addr = 0x9000 + ((signed char)tile_num)*16;
+		for(px = xm%8; px < 8 && x < end; px++, x++, xm++)
+			out[x] = pixels[px];
+	}
+}
 
-		b1 = mem_get_raw(tile_addr+(ym%8)*2);
-		b2 = mem_get_raw(tile_addr+(ym%8)*2+1);
+/* Render all 160 pixels of 'line' in one pass, returns 1 if the window was drawn */
+static int lcd_draw_line(int line, struct oam_cache *o, unsigned char scx_low, int window_line)
+{
+	unsigned char bgcol[160], shades[160];
+	int x, wx, window_start = 160;
 
-		mask = 128>>(xm%8);
+	wx = lcd.window_x - 7;
+	if(line >= lcd.window_y && lcd.window_enabled && line - lcd.window_y < 144 && wx < 160)
+		window_start = wx < 0 ? 0 : wx;
 
-		bgcol = (!!(b2&mask)<<1) | !!(b1&mask);
+	if(lcd.bg_enabled)
+		draw_tiles(bgcol, 0, window_start, lcd.tilemap_select,
+			(lcd.scroll_x & 0xF8) + scx_low, (line + lcd.scroll_y)%256);
+	else
+		memset(bgcol, 0, window_start);
+
+	if(window_start < 160)
+		draw_tiles(bgcol, window_start, 160, lcd.window_tilemap_select,
+			window_start - wx, window_line);
 
-skip_bg:
-		oc = &o[line_fill];
+	for(x = 0; x < 160; x++)
+	{
+		struct oam_cache *oc = &o[x];
 
-		if(sprites_enabled && oc->colour && ((oc->prio && !bgcol) || (!oc->prio)))
+		if(lcd.sprites_enabled && oc->colour && ((oc->prio && !bgcol[x]) || (!oc->prio)))
 		{
-			int *pal = oc->pal ? sprpalette2 : sprpalette1;
-			colour = colours[pal[(int)oc->colour]];
+			int *pal = oc->pal ? lcd.sprpalette2 : lcd.sprpalette1;
+			shades[x] = pal[(int)oc->colour];
 		}
 		else
 		{
-			colour = colours[bgpalette[bgcol]];
+			shades[x] = lcd.bgpalette[bgcol[x]];
 		}
+	}
 
-		POKE(line_fill, line, colour);
+	lcd_hash_line(shades);
+	lcd_output_line(line, shades);
 
-		if(line_fill++ == 159)
-		{
-			lcd_mode = 0;
-			line_fill = 0;
-			if(window_used)
-				window_lines++;
-			window_used = 0;
-			scx_low_latch = 0;
-			if(hblank_int)
-				interrupt(INTR_LCDSTAT);
-		}
-	}
+	return window_start < 160;
 }
 
-int lcd_cycle(void)
+/* Process scanline 'line', cycle 'cycle' within that line */
+static void lcd_do_line(int line, int cycle)
 {
-	int leftover;
+	if(line >= 144)
+	{
+		lcd.mode = 1;
+		lcd.window_lines =  0;
+		return;
+	}
 
+	if(lcd.mode != 2 && cycle < 80)
+	{
+		lcd.mode = 2;
+		if(lcd.oam_int)
+			interrupt(INTR_LCDSTAT);
+	}
+	else if(lcd.mode == 2 && cycle >= 80)
+	{
+		lcd.scx_low_latch = lcd.scroll_x & 7;
+		sprite_fetch(line, lcd.line_oam);
+		lcd.mode = 3;
+	}
+	else if(lcd.mode == 3 && cycle >= 245)
+	{
+		/* The whole line is drawn at the end of mode 3 */
+		if(lcd_draw_line(line, lcd.line_oam, lcd.scx_low_latch, lcd.window_lines))
+			lcd.window_lines++;
 
-	/* Amount of cycles left over since the last full frame */
-	leftover = lcd_cycles % (456 * 154);
+		lcd.mode = 0;
+		if(lcd.hblank_int)
+			interrupt(INTR_LCDSTAT);
+	}
+}
 
-	/* Each scanline is 456 cycles */
-	lcd_line = leftover / 456;
+static void lcd_cycle(void)
+{
+	lcd.line = lcd.next_line;
 
-	if(lcd_line != prev_line && ly_int && lcd_line == lcd_ly_compare)
+	if(lcd.line != lcd.prev_line && lcd.ly_int && lcd.line == lcd.ly_compare)
 	{
 		interrupt(INTR_LCDSTAT);
 	}
 
-	lcd_do_line(lcd_line, leftover % 456);
+	lcd_do_line(lcd.line, lcd.next_dot);
 
-	if(lcd_line == 144 && prev_line == 143)
+	if(lcd.line == 144 && lcd.prev_line == 143)
 	{
-		if(sdl_update())
-			return 0;
+		gb_current->frames++;
+		gb_current->frame_done = 1;
+		lcd.frame_hash = lcd.hash;
+		lcd.hash = HASH_SEED;
 
-		sdl_frame();
-		if(vblank_int)
+		if(lcd.vblank_int)
 			interrupt(INTR_LCDSTAT);
 		interrupt(INTR_VBLANK);
 	}
 
-	prev_line = lcd_line;
+	lcd.prev_line = lcd.line;
 
-	lcd_cycles++;
+	/* Each scanline is 456 cycles, 154 lines to a frame */
+	lcd.time++;
+	if(++lcd.next_dot == 456)
+	{
+		lcd.next_dot = 0;
+		if(++lcd.next_line == 154)
+			lcd.next_line = 0;
+	}
+}
+
+void lcd_state(struct state *s)
+{
+	STATE_VAR(s, lcd.next_line);
+	STATE_VAR(s, lcd.next_dot);
+	STATE_VAR(s, lcd.time);
+	STATE_VAR(s, lcd.line);
+	STATE_VAR(s, lcd.prev_line);
+	STATE_VAR(s, lcd.ly_compare);
+	STATE_VAR(s, lcd.ly_int);
+	STATE_VAR(s, lcd.oam_int);
+	STATE_VAR(s, lcd.vblank_int);
+	STATE_VAR(s, lcd.hblank_int);
+	STATE_VAR(s, lcd.mode);
+	STATE_VAR(s, lcd.enabled);
+	STATE_VAR(s, lcd.window_tilemap_select);
+	STATE_VAR(s, lcd.window_enabled);
+	STATE_VAR(s, lcd.tilemap_select);
+	STATE_VAR(s, lcd.bg_tiledata_select);
+	STATE_VAR(s, lcd.sprite_size);
+	STATE_VAR(s, lcd.sprites_enabled);
+	STATE_VAR(s, lcd.bg_enabled);
+	STATE_VAR(s, lcd.scroll_x);
+	STATE_VAR(s, lcd.scroll_y);
+	STATE_VAR(s, lcd.window_x);
+	STATE_VAR(s, lcd.window_y);
+	STATE_VAR(s, lcd.bgpalette);
+	STATE_VAR(s, lcd.sprpalette1);
+	STATE_VAR(s, lcd.sprpalette2);
+	STATE_VAR(s, lcd.line_oam);
+	STATE_VAR(s, lcd.window_lines);
+	STATE_VAR(s, lcd.scx_low_latch);
+	STATE_VAR(s, lcd.hash);
+	STATE_VAR(s, lcd.frame_hash);
+
+	/* The tile and sprite caches aren't saved, VRAM and OAM are */
+	if(s->loading)
+	{
+		unsigned int addr;
 
-	return 1;
+		for(addr = 0x8000; addr < 0x9800; addr += 2)
+			lcd_write_tile(addr);
+		for(addr = 0xFE00; addr < 0xFEA0; addr += 4)
+			lcd_write_oam(addr);
+
+		lcd.sprites_dirty = 1;
+		lcd.line_oam_clear = 0;
+	}
 }
 
+void lcd_init(void)
+{
+	int i;
+
+	for(i = 0; i < 4; i++)
+	{
+		lcd.bgpalette[i] = i ? 3 : 0;
+		lcd.sprpalette1[i] = i;
+		lcd.sprpalette2[i] = i;
+	}
+
+	for(i = 0; i < 40; i++)
+		lcd_write_oam(0xFE00 + i*4);
+	lcd.sprites_dirty = 1;
+	lcd.line_oam_clear = 1;
+
+	lcd.hash = HASH_SEED;
+	lcd.frame_hash = HASH_SEED;
+
+	lcd.time = 0;
+	lcd_schedule();
+}
+
+/* Skip the idle dots up to time t, then process the dot at t */
+void lcd_event(unsigned int t)
+{
+	lcd.next_dot += t - lcd.time;
+	while(lcd.next_dot >= 456)
+	{
+		lcd.next_dot -= 456;
+		if(++lcd.next_line == 154)
+			lcd.next_line = 0;
+	}
+	lcd.time = t;
+
+	lcd_cycle();
+	lcd_schedule();
+}
@@ -1,6 +1,7 @@
 #ifndef LCD_H
 #define LCD_H
-int lcd_cycle(void);
+void lcd_init(void);
+void lcd_event(unsigned int);
 int lcd_get_line(void);
 unsigned char lcd_get_stat();
 void lcd_write_control(unsigned char);
@@ -14,4 +15,8 @@ void lcd_set_window_y(unsigned char);
 void lcd_set_window_x(unsigned char);
 void lcd_set_ly_compare(unsigned char);
 unsigned char lcd_get_ly_compare(void);
+void lcd_write_tile(unsigned short);
+void lcd_write_oam(unsigned short);
+struct state;
+void lcd_state(struct state *);
 #endif
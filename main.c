@@ -1,59 +1,205 @@
 #include <stdio.h>
-#include "timer.h"
-#include "rom.h"
-#include "mem.h"
-#include "cpu.h"
-#include "lcd.h"
+#include <stdlib.h>
+#include <string.h>
+#include "gb.h"
 #include "sdl.h"
+#include "state.h"
+#include "perf.h"
+#include "movie.h"
+#include "golden.h"
+#include "pace.h"
 
 int main(int argc, char *argv[])
 {
-	int r;
-	const char usage[] = "Usage: %s <rom>\n";
+	int r, i, headless = 0, bench = 0, diverged = 0, pace = -1;
+	gb_t *gb;
+	unsigned int max_frames = 0, max_cycles = 0, buttons = 0, directions = 0, run_ahead = 0;
+	const char *rom = NULL, *load_state = NULL, *save_state = NULL;
+	const char *play = NULL, *record = NULL;
+	const char *check_hashes = NULL, *record_hashes = NULL;
+	struct movie movie_in, movie_out;
+	struct golden golden_in, golden_out;
+	const char usage[] = "Usage: %s [--headless] [--bench] [--frames n] [--cycles n] "
+		"[--load-state file] [--save-state file] [--play movie] [--record movie] "
+		"[--check-hashes file] [--record-hashes file] [--pace timer|vsync|audio|none] "
+		"[--run-ahead frames] <rom>\n";
+	const char *pace_names[] = {"none", "timer", "vsync", "audio"};
 
-	if(argc != 2) {
+	for(i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--headless"))
+			headless = 1;
+		else if(!strcmp(argv[i], "--bench"))
+			headless = bench = 1;
+		else if(!strcmp(argv[i], "--frames") && i+1 < argc)
+			max_frames = strtoul(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "--cycles") && i+1 < argc)
+			max_cycles = strtoul(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "--load-state") && i+1 < argc)
+			load_state = argv[++i];
+		else if(!strcmp(argv[i], "--save-state") && i+1 < argc)
+			save_state = argv[++i];
+		else if(!strcmp(argv[i], "--play") && i+1 < argc)
+			play = argv[++i];
+		else if(!strcmp(argv[i], "--record") && i+1 < argc)
+			record = argv[++i];
+		else if(!strcmp(argv[i], "--check-hashes") && i+1 < argc)
+			check_hashes = argv[++i];
+		else if(!strcmp(argv[i], "--record-hashes") && i+1 < argc)
+			record_hashes = argv[++i];
+		else if(!strcmp(argv[i], "--run-ahead") && i+1 < argc)
+			run_ahead = strtoul(argv[++i], NULL, 0);
+		else if(!strcmp(argv[i], "--pace") && i+1 < argc)
+		{
+			for(pace = 3; pace >= 0; pace--)
+				if(!strcmp(argv[i+1], pace_names[pace]))
+					break;
+			if(pace < 0)
+				break;
+			i++;
+		}
+		else if(!rom && argv[i][0] != '-')
+			rom = argv[i];
+		else
+			break;
+	}
+
+	if(!rom || i != argc) {
 		fprintf(stderr, usage, argv[0]);
 		return 0;
 	}
 
-	r = rom_load(argv[1]);
-	if(!r)
+	gb = gb_create(rom);
+	if(!gb)
 		return 0;
 
-	sdl_init();
+	if(!bench)
+		printf("ROM OK!\n");
 
-	printf("ROM OK!\n");
+	sdl_init(headless);
+	gb_set_framebuffer(gb, sdl_get_framebuffer());
+	gb_set_audio(gb, sdl_get_audio());
 
-	mem_init();
-	printf("Mem OK!\n");
+	/* Follow the sound if there is any, headless runs go flat out */
+	if(pace < 0)
+		pace = headless ? PACE_NONE : sdl_get_audio() ? PACE_AUDIO : PACE_TIMER;
+	pace_init(pace, sdl_get_audio());
 
-	cpu_init();
-	printf("CPU OK!\n");
+	if(load_state && !state_load_file(gb, load_state))
+	{
+		fprintf(stderr, "Couldn't load state from %s\n", load_state);
+		return 0;
+	}
 
-	r = 0;
+	if(play && !movie_load(&movie_in, play))
+	{
+		fprintf(stderr, "Couldn't load input movie %s\n", play);
+		return 0;
+	}
+
+	if(record && !movie_record(&movie_out, record))
+	{
+		fprintf(stderr, "Couldn't record input movie to %s\n", record);
+		return 0;
+	}
+
+	if(check_hashes && !golden_load(&golden_in, check_hashes))
+	{
+		fprintf(stderr, "Couldn't load frame hashes %s\n", check_hashes);
+		return 0;
+	}
+
+	if(record_hashes && !golden_record(&golden_out, record_hashes))
+	{
+		fprintf(stderr, "Couldn't record frame hashes to %s\n", record_hashes);
+		return 0;
+	}
+
+	/* A movie replaces the keyboard, input can start on frame 0 */
+	if(play)
+	{
+		movie_play(&movie_in, 0, &buttons, &directions);
+		gb_set_input(gb, buttons, directions);
+	}
+
+	if(bench)
+		perf_enable();
 
 	while(1)
 	{
-		int now;
+		unsigned int frames = gb_get_frames(gb);
 
-		if(!cpu_cycle())
+		if(max_cycles)
+			r = gb_run_until(gb, max_cycles);
+		else
+			r = gb_run_ahead(gb, run_ahead);
+		if(r == GB_ERROR)
 			break;
 
-		now = cpu_get_cycles();
-
-		while(now != r)
+		if(gb_get_frames(gb) != frames)
 		{
-			if(!lcd_cycle())
-				goto out;
-			r++;
+			sdl_frame();
+
+			if(record_hashes)
+				golden_write(&golden_out, gb_get_frames(gb), gb_get_frame_hash(gb));
+
+			if(check_hashes)
+			{
+				unsigned long long expected;
 
-			timer_cycle();
+				if(!golden_check(&golden_in, gb_get_frames(gb), gb_get_frame_hash(gb), &expected))
+				{
+					fprintf(stderr, "Frame %u hash %016llx, expected %016llx\n",
+						gb_get_frames(gb), gb_get_frame_hash(gb), expected);
+					diverged = 1;
+					break;
+				}
+			}
+
+			/* Input is read after the wait, just before it's used */
+			pace_frame();
+			if(sdl_update())
+				break;
+
+			if(play)
+				movie_play(&movie_in, gb_get_frames(gb), &buttons, &directions);
+			else
+			{
+				buttons = sdl_get_buttons();
+				directions = sdl_get_directions();
+			}
+
+			if(record)
+				movie_write(&movie_out, gb_get_frames(gb), buttons, directions);
+
+			gb_set_input(gb, buttons, directions);
 		}
 
-		r = now;
+		if(r == GB_CYCLES)
+			break;
+		if(max_frames && gb_get_frames(gb) >= max_frames)
+			break;
 	}
-out:
+
+	if(bench)
+		perf_report(rom, gb_get_frames(gb), gb_get_instructions(gb));
+	else if(max_frames || max_cycles)
+		printf("Stopped after %u frames, %u cycles\n", gb_get_frames(gb), gb_get_cycles(gb));
+
+	if(save_state && !state_save_file(gb, save_state))
+		fprintf(stderr, "Couldn't save state to %s\n", save_state);
+
+	if(play)
+		movie_close(&movie_in);
+	if(record)
+		movie_close(&movie_out);
+	if(check_hashes)
+		golden_close(&golden_in);
+	if(record_hashes)
+		golden_close(&golden_out);
+
 	sdl_quit();
+	gb_destroy(gb);
 
-	return 0;
+	return diverged;
 }
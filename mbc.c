@@ -1,50 +1,185 @@
+#define _POSIX_C_SOURCE 200112L
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "mbc.h"
 #include "mem.h"
 #include "rom.h"
+#include "cpu.h"
+#include "sched.h"
+#include "state.h"
+#include "gb.h"
 
+#define mbc (gb_current->mbc)
+
+/* Emulated cycles in a second */
+#define RTC_SECOND 4194304
+
+/* The clock registers follow the RAM: live S, M, H, DL, DH, then the
+ * same again as last latched.
+ */
 enum {
-	NO_FILTER_WRITE,
-	FILTER_WRITE
+	RTC_S,
+	RTC_M,
+	RTC_H,
+	RTC_DL,
+	RTC_DH,
+	RTC_LATCHED,
+	RTC_SIZE = 2*RTC_LATCHED
 };
 
-static unsigned int bank_upper_bits;
-static unsigned int ram_select;
-
-/* Unfinished, no clock etc */
-unsigned int MBC3_write_byte(unsigned short d, unsigned char i)
+/* Map 'size' bytes of 'filename' read/write, creating or growing it as
+ * needed. Writes go straight to the file, there's nothing to flush.
+ */
+static unsigned char *mbc_map_save(const char *filename, unsigned int size)
 {
-	int bank;
+#ifdef _WIN32
+	HANDLE f, map;
+#else
+	int f;
+	struct stat st;
+#endif
+	unsigned char *bytes;
 
-	if(d < 0x2000)
+#ifdef _WIN32
+	f = CreateFile(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if(f == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	map = CreateFileMapping(f, NULL, PAGE_READWRITE, 0, size, NULL);
+	CloseHandle(f);
+	if(!map)
+		return NULL;
+
+	bytes = MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, size);
+	CloseHandle(map);
+#else
+	f = open(filename, O_RDWR | O_CREAT, 0644);
+	if(f == -1)
+		return NULL;
+
+	if(fstat(f, &st) == -1 || (st.st_size < (off_t)size && ftruncate(f, size) == -1))
 	{
-		return FILTER_WRITE;
+		close(f);
+		return NULL;
 	}
 
-	if(d < 0x4000)
-	{
-		bank = i & 0x7F;
+	bytes = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+	close(f);
+	if(bytes == MAP_FAILED)
+		return NULL;
+#endif
+	return bytes;
+}
 
-		if(bank == 0)
-			bank++;
+/* foo.gb saves to foo.sav */
+static char *mbc_save_name(const char *rom_name)
+{
+	const char *dot = strrchr(rom_name, '.');
+	size_t n = strlen(rom_name);
+	char *name;
 
-		mem_bank_switch(bank);
+	if(dot && !strchr(dot, '/') && !strchr(dot, '\\'))
+		n = dot - rom_name;
+
+	name = malloc(n + 5);
+	memcpy(name, rom_name, n);
+	strcpy(&name[n], ".sav");
 
-		return FILTER_WRITE;
+	return name;
+}
+
+/* Point A000-BFFF at the selected RAM bank or clock register, or at
+ * nothing.
+ */
+static void mbc_map_ram(void)
+{
+	if(!mbc.ram_enabled)
+		mem_sram_switch(NULL);
+	else if(mbc.rtc_select)
+	{
+		unsigned char r = mbc.rtc[RTC_LATCHED + mbc.rtc_select - 8];
+
+		/* The page always holds one value throughout */
+		if(mbc.rtc_page[0] != r)
+			memset(mbc.rtc_page, r, sizeof mbc.rtc_page);
+		mem_sram_switch(mbc.rtc_page);
 	}
+	else if(mbc.ram_size)
+		mem_sram_switch(&mbc.ram[(mbc.ram_bank * 0x2000) % mbc.ram_size]);
+	else
+		mem_sram_switch(NULL);
+}
+
+/* The clock moves on a second every RTC_SECOND cycles of emulated time,
+ * not wall clock time, so runs stay repeatable.
+ */
+void mbc_rtc_event(unsigned int t)
+{
+	unsigned char *r = mbc.rtc;
+
+	sched_add(EVENT_RTC, t + RTC_SECOND);
 
-	if(d < 0x8000)
-		return FILTER_WRITE;
+	if(r[RTC_DH] & 0x40)
+		return;
 
-	return NO_FILTER_WRITE;
+	r[RTC_S] = (r[RTC_S] + 1) & 0x3F;
+	if(r[RTC_S] != 60)
+		return;
+	r[RTC_S] = 0;
+
+	r[RTC_M] = (r[RTC_M] + 1) & 0x3F;
+	if(r[RTC_M] != 60)
+		return;
+	r[RTC_M] = 0;
+
+	r[RTC_H] = (r[RTC_H] + 1) & 0x1F;
+	if(r[RTC_H] != 24)
+		return;
+	r[RTC_H] = 0;
+
+	if(++r[RTC_DL])
+		return;
+
+	/* Day 511 wraps to 0 and sets the carry */
+	if(r[RTC_DH] & 1)
+		r[RTC_DH] = (r[RTC_DH] & ~1) | 0x80;
+	else
+		r[RTC_DH] |= 1;
 }
-unsigned int MBC1_write_byte(unsigned short d, unsigned char i)
+
+static void mbc_rtc_write(int reg, unsigned char i)
+{
+	static const unsigned char masks[5] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+
+	/* Setting the seconds restarts the second in progress */
+	if(reg == RTC_S)
+		sched_add(EVENT_RTC, cpu_get_cycles() + RTC_SECOND);
+
+	mbc.rtc[reg] = mbc.rtc[RTC_LATCHED + reg] = i & masks[reg];
+	mbc_map_ram();
+}
+
+/* Writes to 0000-7FFF */
+static void MBC1_write_byte(unsigned short d, unsigned char i)
 {
 	int bank;
 
+	/* RAM is enabled by writing xA to 0000-1fff */
 	if(d < 0x2000)
 	{
-		return FILTER_WRITE;
-		/* TODO: Enable/disable SRAM */
+		mbc.ram_enabled = (i & 0xF) == 0xA;
+		mbc_map_ram();
 	}
 
 	/* Switch rom bank at 4000-7fff */
@@ -55,8 +190,8 @@ unsigned int MBC1_write_byte(unsigned short d, unsigned char i)
 		 * RAM select is 1.
 		 */
 		bank = i & 0x1F;
-		if(!ram_select)
-			bank |= bank_upper_bits;
+		if(!mbc.ram_select)
+			bank |= mbc.bank_upper_bits;
 
 		/* "Writing to this address space selects the lower 5 bits of the
 		 * ROM Bank Number (in range 01-1Fh). When 00h is written, the MBC
@@ -68,21 +203,258 @@ unsigned int MBC1_write_byte(unsigned short d, unsigned char i)
 			bank++;
 
 		mem_bank_switch(bank);
-
-		return FILTER_WRITE;
 	}
 
 	/* Bit 5 and 6 of the bank selection */
 	if(d >= 0x4000 && d < 0x6000)
+		mbc.bank_upper_bits = (i & 0x3)<<5;
+
+	if(d >= 0x6000 && d <= 0x7FFF)
+		mbc.ram_select = i&1;
+
+	/* With RAM select set the upper bits pick the RAM bank instead */
+	if(d >= 0x4000)
+	{
+		mbc.ram_bank = mbc.ram_select ? mbc.bank_upper_bits>>5 : 0;
+		mbc_map_ram();
+	}
+}
+
+/* Writes to 0000-3FFF, address bit 8 picks RAM enable or the ROM bank */
+static void MBC2_write_byte(unsigned short d, unsigned char i)
+{
+	int bank;
+
+	if(d & 0x100)
+	{
+		bank = i & 0xF;
+
+		if(bank == 0)
+			bank++;
+
+		mem_bank_switch(bank);
+	}
+	else
+	{
+		mbc.ram_enabled = (i & 0xF) == 0xA;
+		mbc_map_ram();
+	}
+}
+
+/* 512 nibbles of RAM, repeated all the way through A000-BFFF. Every copy
+ * is written so reads can come straight from the bank.
+ */
+static void MBC2_write_ram(unsigned short d, unsigned char i)
+{
+	int a;
+
+	if(!mbc.ram_enabled)
+		return;
+
+	for(a = d & 0x1FF; a < 0x2000; a += 0x200)
+		mbc.ram[a] = i | 0xF0;
+}
+
+/* Writes to 0000-7FFF */
+static void MBC3_write_byte(unsigned short d, unsigned char i)
+{
+	int bank;
+
+	/* RAM is enabled by writing xA to 0000-1fff */
+	if(d < 0x2000)
 	{
-		bank_upper_bits = (i & 0x3)<<5;
-		return FILTER_WRITE;
+		mbc.ram_enabled = (i & 0xF) == 0xA;
+		mbc_map_ram();
 	}
 
+	if(d >= 0x2000 && d < 0x4000)
+	{
+		bank = i & 0x7F;
+
+		if(bank == 0)
+			bank++;
+
+		mem_bank_switch(bank);
+	}
+
+	/* RAM bank 0-7, or 08-0C for a clock register */
+	if(d >= 0x4000 && d < 0x6000)
+	{
+		if(mbc.rtc && i >= 0x08 && i <= 0x0C)
+			mbc.rtc_select = i;
+		else
+		{
+			mbc.rtc_select = 0;
+			mbc.ram_bank = i & 0x7;
+		}
+		mbc_map_ram();
+	}
+
+	/* Writing 0 then 1 latches the clock */
 	if(d >= 0x6000 && d <= 0x7FFF)
 	{
-		ram_select = i&1;
-		return FILTER_WRITE;
+		if(mbc.rtc && mbc.rtc_latch == 0 && i == 1)
+		{
+			memcpy(&mbc.rtc[RTC_LATCHED], mbc.rtc, RTC_LATCHED);
+			mbc_map_ram();
+		}
+		mbc.rtc_latch = i;
+	}
+}
+
+static void MBC3_write_ram(unsigned short d, unsigned char i)
+{
+	if(!mbc.ram_enabled)
+		return;
+
+	if(mbc.rtc_select)
+		mbc_rtc_write(mbc.rtc_select - 8, i);
+	else if(mbc.ram_size)
+		mbc.ram[(mbc.ram_bank * 0x2000) % mbc.ram_size + (d - 0xA000)] = i;
+}
+
+/* Writes to 0000-5FFF, the ROM bank is 9 bits and bank 0 is allowed */
+static void MBC5_write_byte(unsigned short d, unsigned char i)
+{
+	if(d < 0x2000)
+	{
+		mbc.ram_enabled = (i & 0xF) == 0xA;
+		mbc_map_ram();
+	}
+
+	if(d >= 0x2000 && d < 0x3000)
+	{
+		mbc.rom_bank = (mbc.rom_bank & 0x100) | i;
+		mem_bank_switch(mbc.rom_bank);
+	}
+
+	if(d >= 0x3000 && d < 0x4000)
+	{
+		mbc.rom_bank = (mbc.rom_bank & 0xFF) | (i & 1)<<8;
+		mem_bank_switch(mbc.rom_bank);
+	}
+
+	/* On rumble carts bit 3 drives the motor instead of the RAM bank */
+	if(d >= 0x4000 && d < 0x6000)
+	{
+		if(rom_has_rumble())
+		{
+			mbc.rumble = !!(i & 0x8);
+			i &= 0x7;
+		}
+
+		mbc.ram_bank = i & 0xF;
+		mbc_map_ram();
+	}
+}
+
+/* Set up the cartridge RAM and clock, kept in a .sav next to 'filename'
+ * if the cart has a battery. With no filename they only live in memory.
+ */
+void mbc_init(const char *filename)
+{
+	unsigned int size = rom_get_ram_size();
+
+	/* MBC2 has its RAM built in, the header says none */
+	if(rom_get_mapper() == MBC2)
+		size = 0x200;
+
+	if(size && size < 0x2000)
+		size = 0x2000;
+
+	mbc.ram_size = size;
+	mbc.save_size = size + (rom_has_rtc() ? RTC_SIZE : 0);
+
+	if(mbc.save_size)
+	{
+		if(filename && rom_has_battery())
+		{
+			char *name = mbc_save_name(filename);
+
+			mbc.ram = mbc_map_save(name, mbc.save_size);
+			mbc.ram_mapped = !!mbc.ram;
+			if(!mbc.ram)
+				fprintf(stderr, "Couldn't map %s, the game won't be saved\n", name);
+
+			free(name);
+		}
+
+		if(!mbc.ram)
+			mbc.ram = calloc(1, mbc.save_size);
+	}
+
+	if(rom_has_rtc())
+	{
+		mbc.rtc = &mbc.ram[size];
+		sched_add(EVENT_RTC, cpu_get_cycles() + RTC_SECOND);
 	}
-	return NO_FILTER_WRITE;
+
+	mbc.rom_bank = 1;
+
+	switch(rom_get_mapper())
+	{
+		case MBC1:
+			mem_set_write_pages(0x00, 0x7F, MBC1_write_byte);
+		break;
+		case MBC2:
+		{
+			unsigned int i;
+
+			/* The unused upper nibbles read back as 1s */
+			for(i = 0; i < size; i++)
+				mbc.ram[i] |= 0xF0;
+
+			mem_set_write_pages(0x00, 0x3F, MBC2_write_byte);
+			mem_set_write_pages(0xA0, 0xBF, MBC2_write_ram);
+		}
+		break;
+		case MBC3:
+			mem_set_write_pages(0x00, 0x7F, MBC3_write_byte);
+			mem_set_write_pages(0xA0, 0xBF, MBC3_write_ram);
+		break;
+		case MBC5:
+			mem_set_write_pages(0x00, 0x5F, MBC5_write_byte);
+		break;
+		default:
+			/* No enable register to handle, just leave it on */
+			mbc.ram_enabled = 1;
+		break;
+	}
+
+	mbc_map_ram();
+}
+
+void mbc_unload(void)
+{
+	if(!mbc.ram)
+		return;
+
+	if(mbc.ram_mapped)
+#ifdef _WIN32
+		UnmapViewOfFile(mbc.ram);
+#else
+		munmap(mbc.ram, mbc.save_size);
+#endif
+	else
+		free(mbc.ram);
+
+	mbc.ram = NULL;
+	mbc.rtc = NULL;
+}
+
+void mbc_state(struct state *s)
+{
+	STATE_VAR(s, mbc.bank_upper_bits);
+	STATE_VAR(s, mbc.ram_select);
+	STATE_VAR(s, mbc.ram_enabled);
+	STATE_VAR(s, mbc.ram_bank);
+	STATE_VAR(s, mbc.rom_bank);
+	STATE_VAR(s, mbc.rtc_select);
+	STATE_VAR(s, mbc.rtc_latch);
+	STATE_VAR(s, mbc.rumble);
+	if(mbc.ram)
+		state_var(s, mbc.ram, mbc.save_size);
+
+	if(s->loading)
+		mbc_map_ram();
 }
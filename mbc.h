@@ -1,5 +1,8 @@
 #ifndef MBC_H
 #define MBC_H
-unsigned int MBC1_write_byte(unsigned short, unsigned char);
-unsigned int MBC3_write_byte(unsigned short, unsigned char);
+void mbc_init(const char *);
+void mbc_unload(void);
+void mbc_rtc_event(unsigned int);
+struct state;
+void mbc_state(struct state *);
 #endif
@@ -1,58 +1,98 @@
-#include <stdlib.h>
 #include <string.h>
 #include "mem.h"
 #include "rom.h"
 #include "lcd.h"
-#include "mbc.h"
 #include "interrupt.h"
 #include "timer.h"
-#include "sdl.h"
+#include "serial.h"
+#include "apu.h"
 #include "cpu.h"
+#include "sched.h"
+#include "state.h"
+#include "gb.h"
 
-static unsigned char *mem;
-static int DMA_pending = 0;
-static int joypad_select_buttons, joypad_select_directions;
+#define mem (gb_current->mem)
+
+#define REGION(p) (mem.regions[(p)>>12][(p)&0xFFF])
+
+/* Refresh the read pages of regions first to last */
+static void mem_map_pages(int first, int last)
+{
+	int p;
+
+	for(p = first*16; p < (last+1)*16; p++)
+	{
+		if(p == 0xFF || mem.dma_pending)
+			mem.read_pages[p] = NULL;
+		else
+			mem.read_pages[p] = &mem.regions[p>>4][(p&0xF)*0x100];
+	}
+}
 
 void mem_bank_switch(unsigned int n)
 {
 	unsigned char *b = rom_getbytes();
+	int i;
+
+	/* Banks past the end of the ROM wrap around */
+	n %= rom_get_banks();
+
+	mem.rom_bank = n;
+	for(i = 0; i < 4; i++)
+		mem.regions[4+i] = &b[n*0x4000 + i*0x1000];
+
+	mem_map_pages(4, 7);
+}
+
+/* Point A000-BFFF at an 8KiB bank of cartridge RAM, NULL for none */
+void mem_sram_switch(unsigned char *bank)
+{
+	mem.regions[0xA] = bank ? bank : mem.no_sram;
+	mem.regions[0xB] = bank ? bank + 0x1000 : mem.no_sram;
 
-	memcpy(&mem[0x4000], &b[n * 0x4000], 0x4000);
+	mem_map_pages(0xA, 0xB);
+}
+
+void mem_dma_end(void)
+{
+	mem.dma_pending = 0;
+	mem_map_pages(0, 15);
 }
 
 /* LCD's access to VRAM */
 inline unsigned char mem_get_raw(unsigned short p)
 {
-	return mem[p];
+	return REGION(p);
 }
 
-unsigned char mem_get_byte(unsigned short i)
+static unsigned char mem_get_byte_slow(unsigned short i)
 {
-	unsigned long elapsed;
 	unsigned char mask = 0;
 
-	if(DMA_pending && i < 0xFF80)
-	{
-		elapsed = cpu_get_cycles() - DMA_pending;
-		if(elapsed >= 160)
-			DMA_pending = 0;
-		else
-		{
-			return mem[0xFE00+elapsed];
-		}
-	}
+	/* Only HRAM is visible while OAM DMA runs */
+	if(mem.dma_pending && i < 0xFF80)
+		return mem.ram[0xFE00 + cpu_get_cycles() - mem.dma_pending];
 
 	if(i < 0xFF00)
-		return mem[i];
+		return REGION(i);
+
+	if(i >= 0xFF10 && i < 0xFF40)
+		return apu_read(i);
 
 	switch(i)
 	{
 		case 0xFF00:	/* Joypad */
-			if(!joypad_select_buttons)
-				mask = sdl_get_buttons();
-			if(!joypad_select_directions)
-				mask = sdl_get_directions();
-			return 0xC0 | (0xF^mask) | (joypad_select_buttons | joypad_select_directions);
+			if(!mem.joypad_select_buttons)
+				mask = gb_current->buttons;
+			if(!mem.joypad_select_directions)
+				mask = gb_current->directions;
+			return 0xC0 | (0xF^mask) | (mem.joypad_select_buttons | mem.joypad_select_directions);
+		break;
+		case 0xFF01:
+			return serial_get_data();
+		break;
+		case 0xFF02:
+			return serial_get_control();
 		break;
 		case 0xFF04:
 			return timer_get_div();
@@ -89,57 +129,91 @@ unsigned char mem_get_byte(unsigned short i)
 	if(i > 0x8000 && i < 0x9FFF && (lcd_get_stat() & 2) == 3)
 		return 0xFF;
 
-	return mem[i];
+	return mem.ram[i];
+}
+
+unsigned char mem_get_byte(unsigned short i)
+{
+	unsigned char *page = mem.read_pages[i>>8];
+
+	if(page)
+		return page[i&0xFF];
+
+	return mem_get_byte_slow(i);
 }
 
 unsigned short mem_get_word(unsigned short i)
 {
-	unsigned long elapsed;
+	unsigned char *page = mem.read_pages[i>>8];
+
+	/* Both bytes in the same plain page */
+	if(page && (i&0xFF) != 0xFF)
+		return page[i&0xFF] | page[(i&0xFF)+1]<<8;
+
+	if(mem.dma_pending && i < 0xFF80)
+		return mem.ram[0xFE00 + cpu_get_cycles() - mem.dma_pending];
+
+	return REGION(i) | (REGION((unsigned short)(i+1))<<8);
+}
+
+/* ROM without a mapper we handle, writes go nowhere */
+static void mem_write_ignore(unsigned short d, unsigned char i)
+{
+	(void)d;
+	(void)i;
+}
 
-	if(DMA_pending && i < 0xFF80)
+static void mem_write_vram(unsigned short d, unsigned char i)
+{
+#if 0
+	/* Too broken to work yet */
+	if((lcd_get_stat() & 3) == 3)
+		i = 0xFF;
+#endif
+	if(mem.ram[d] != i)
 	{
-		elapsed = cpu_get_cycles() - DMA_pending;
-		if(elapsed >= 160)
-			DMA_pending = 0;
-		else
-		{
-			return mem[0xFE00+elapsed];
-		}
+		mem.ram[d] = i;
+		lcd_write_tile(d);
 	}
-	return mem[i] | (mem[i+1]<<8);
 }
 
-void mem_write_byte(unsigned short d, unsigned char i)
+static void mem_write_oam(unsigned short d, unsigned char i)
 {
-	unsigned int filtered = 0;
-
-	switch(rom_get_mapper())
+	if(d < 0xFEA0 && mem.ram[d] != i)
 	{
-		case NROM:
-			if(d < 0x8000)
-				filtered = 1;
-		break;
-		case MBC2:
-		case MBC3:
-		case MBC5:
-			filtered = MBC3_write_byte(d, i);
-		break;
-		case MBC1:
-			filtered = MBC1_write_byte(d, i);
-		break;
+		mem.ram[d] = i;
+		lcd_write_oam(d);
+		return;
 	}
 
-	if(filtered)
+	mem.ram[d] = i;
+}
+
+static void mem_write_sram(unsigned short d, unsigned char i)
+{
+	if(mem.regions[0xA] != mem.no_sram)
+		REGION(d) = i;
+}
+
+static void mem_write_io(unsigned short d, unsigned char i)
+{
+	if(d >= 0xFF10 && d < 0xFF40)
+	{
+		apu_write(d, i);
 		return;
+	}
 
 	switch(d)
 	{
 		case 0xFF00:	/* Joypad */
-			joypad_select_buttons = i&0x20;
-			joypad_select_directions = i&0x10;
+			mem.joypad_select_buttons = i&0x20;
+			mem.joypad_select_directions = i&0x10;
 		break;
 		case 0xFF01: /* Link port data */
-//			fprintf(stderr, "%c", i);
+			serial_write_data(i);
+		break;
+		case 0xFF02:
+			serial_write_control(i);
 		break;
 		case 0xFF04:
 			timer_set_div(i);
@@ -172,9 +246,17 @@ void mem_write_byte(unsigned short d, unsigned char i)
 			lcd_set_ly_compare(i);
 		break;
 		case 0xFF46: /* OAM DMA */
+		{
+			unsigned short oam;
+
 			/* Copy bytes from i*0x100 to OAM */
-			memcpy(&mem[0xFE00], &mem[i*0x100], 0xA0);
-			DMA_pending = cpu_get_cycles();
+			memcpy(&mem.ram[0xFE00], &REGION(i*0x100), 0xA0);
+			for(oam = 0xFE00; oam < 0xFEA0; oam += 4)
+				lcd_write_oam(oam);
+			mem.dma_pending = cpu_get_cycles();
+			mem_map_pages(0, 15);
+			sched_add(EVENT_DMA, mem.dma_pending + 159);
+		}
 		break;
 		case 0xFF47:
 			lcd_write_bg_palette(i);
@@ -195,48 +277,73 @@ void mem_write_byte(unsigned short d, unsigned char i)
 		break;
 	}
 
-#if 0
-	/* Too broken to work yet */
-	if(d > 0x8000 && d < 0x9FFF && (lcd_get_stat() & 3) == 3)
-		i = 0xFF;
-#endif
-	mem[d] = i;
+	mem.ram[d] = i;
+}
+
+/* Send writes to pages first to last to 'write', NULL for plain RAM */
+void mem_set_write_pages(int first, int last, void (*write)(unsigned short, unsigned char))
+{
+	int i;
+
+	for(i = first; i <= last; i++)
+		mem.write_pages[i] = write;
+}
+
+void mem_write_byte(unsigned short d, unsigned char i)
+{
+	void (*write)(unsigned short, unsigned char) = mem.write_pages[d>>8];
+
+	if(write)
+		write(d, i);
+	else
+		mem.ram[d] = i;
 }
 
 void mem_write_word(unsigned short d, unsigned short i)
 {
-	mem[d] = i&0xFF;
-	//mem_write_byte(d, i&0xFF);
+	mem_write_byte(d, i&0xFF);
 	mem_write_byte(d+1, i>>8);
-//	mem[d+1] = i>>8;
+}
+
+/* Only 8000-FFFF lives in mem, the ROM side is just which bank is mapped */
+void mem_state(struct state *s)
+{
+	state_var(s, &mem.ram[0x8000], 0x8000);
+	STATE_VAR(s, mem.dma_pending);
+	STATE_VAR(s, mem.joypad_select_buttons);
+	STATE_VAR(s, mem.joypad_select_directions);
+	STATE_VAR(s, mem.rom_bank);
+
+	if(s->loading)
+	{
+		mem_bank_switch(mem.rom_bank);
+		mem_map_pages(0, 15);
+	}
 }
 
 void mem_init(void)
 {
 	unsigned char *bytes = rom_getbytes();
+	int i;
+
+	for(i = 0; i < 16; i++)
+		mem.regions[i] = i < 8 ? &bytes[i*0x1000] : &mem.ram[i*0x1000];
+	mem.rom_bank = 1;
+	mem_map_pages(0, 15);
+
+	/* No cartridge RAM until mbc_init() maps some */
+	memset(mem.no_sram, 0xFF, sizeof mem.no_sram);
+	mem_sram_switch(NULL);
+
+	/* mbc_init() replaces the ROM and cartridge RAM handlers */
+	mem_set_write_pages(0x00, 0x7F, mem_write_ignore);
+	mem_set_write_pages(0x80, 0x97, mem_write_vram);
+	mem_set_write_pages(0xA0, 0xBF, mem_write_sram);
+	mem_set_write_pages(0xFE, 0xFE, mem_write_oam);
+	mem_set_write_pages(0xFF, 0xFF, mem_write_io);
 
-	mem = calloc(1, 0x10000);
-
-	memcpy(&mem[0x0000], &bytes[0x0000], 0x4000);
-	memcpy(&mem[0x4000], &bytes[0x4000], 0x4000);
-
-	mem[0xFF10] = 0x80;
-	mem[0xFF11] = 0xBF;
-	mem[0xFF12] = 0xF3;
-	mem[0xFF14] = 0xBF;
-	mem[0xFF16] = 0x3F;
-	mem[0xFF19] = 0xBF;
-	mem[0xFF1A] = 0x7F;
-	mem[0xFF1B] = 0xFF;
-	mem[0xFF1C] = 0x9F;
-	mem[0xFF1E] = 0xBF;
-	mem[0xFF20] = 0xFF;
-	mem[0xFF23] = 0xBF;
-	mem[0xFF24] = 0x77;
-	mem[0xFF25] = 0xF3;
-	mem[0xFF26] = 0xF1;
-	mem[0xFF40] = 0x91;
-	mem[0xFF47] = 0xFC;
-	mem[0xFF48] = 0xFF;
-	mem[0xFF49] = 0xFF;
+	mem.ram[0xFF40] = 0x91;
+	mem.ram[0xFF47] = 0xFC;
+	mem.ram[0xFF48] = 0xFF;
+	mem.ram[0xFF49] = 0xFF;
 }
@@ -8,5 +8,10 @@ unsigned short mem_get_word(unsigned short);
 void mem_write_byte(unsigned short, unsigned char);
 void mem_write_word(unsigned short, unsigned short);
 void mem_bank_switch(unsigned int);
+void mem_sram_switch(unsigned char *);
+void mem_set_write_pages(int, int, void (*)(unsigned short, unsigned char));
 unsigned char mem_get_raw(unsigned short);
+void mem_dma_end(void);
+struct state;
+void mem_state(struct state *);
 #endif
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+
+/* Input movies are text, one "frame key..." line per change of the held
+ * keys, so a run's input is a few lines however long it is. A frame with
+ * no keys lets everything go. Lines starting with # are comments.
+ */
+static const char *keys[] = {
+	"a", "b", "select", "start", "right", "left", "up", "down"
+};
+
+int movie_load(struct movie *m, const char *filename)
+{
+	char line[256];
+	unsigned int i;
+	FILE *f;
+
+	memset(m, 0, sizeof *m);
+
+	f = fopen(filename, "r");
+	if(!f)
+		return 0;
+
+	while(fgets(line, sizeof line, f))
+	{
+		struct input_event e = {0, 0, 0};
+		char *tok = strtok(line, " \t\r\n");
+
+		if(!tok || tok[0] == '#')
+			continue;
+
+		e.frame = strtoul(tok, NULL, 0);
+		while((tok = strtok(NULL, " \t\r\n")))
+		{
+			for(i = 0; i < 8; i++)
+				if(!strcmp(tok, keys[i]))
+					break;
+
+			if(i == 8)
+				fprintf(stderr, "%s: unknown key %s\n", filename, tok);
+			else if(i < 4)
+				e.buttons |= 1<<i;
+			else
+				e.directions |= 1<<(i-4);
+		}
+
+		m->events = realloc(m->events, (m->count + 1) * sizeof *m->events);
+		m->events[m->count++] = e;
+	}
+
+	fclose(f);
+
+	return 1;
+}
+
+/* The keys held during 'frame', frames have to come in order */
+void movie_play(struct movie *m, unsigned int frame, unsigned int *buttons, unsigned int *directions)
+{
+	while(m->next < m->count && m->events[m->next].frame <= frame)
+	{
+		m->buttons = m->events[m->next].buttons;
+		m->directions = m->events[m->next].directions;
+		m->next++;
+	}
+
+	*buttons = m->buttons;
+	*directions = m->directions;
+}
+
+int movie_record(struct movie *m, const char *filename)
+{
+	memset(m, 0, sizeof *m);
+
+	m->out = fopen(filename, "w");
+
+	return m->out != NULL;
+}
+
+/* Note the keys held during 'frame', if they changed */
+void movie_write(struct movie *m, unsigned int frame, unsigned int buttons, unsigned int directions)
+{
+	unsigned int i;
+
+	if(buttons == m->buttons && directions == m->directions)
+		return;
+
+	fprintf(m->out, "%u", frame);
+	for(i = 0; i < 8; i++)
+		if((i < 4 ? buttons>>i : directions>>(i-4)) & 1)
+			fprintf(m->out, " %s", keys[i]);
+	fprintf(m->out, "\n");
+
+	m->buttons = buttons;
+	m->directions = directions;
+}
+
+void movie_close(struct movie *m)
+{
+	if(m->out)
+		fclose(m->out);
+
+	free(m->events);
+	memset(m, 0, sizeof *m);
+}
@@ -0,0 +1,27 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+#include <stdio.h>
+
+/* Held keys from 'frame' on, bits as sdl_get_buttons() and
+ * sdl_get_directions() return them.
+ */
+struct input_event {
+	unsigned int frame;
+	unsigned int buttons, directions;
+};
+
+struct movie {
+	struct input_event *events;
+	unsigned int count;
+	unsigned int next;	/* Next event to play */
+
+	FILE *out;	/* Recording to */
+	unsigned int buttons, directions;	/* Last written */
+};
+
+int movie_load(struct movie *, const char *);
+void movie_play(struct movie *, unsigned int, unsigned int *, unsigned int *);
+int movie_record(struct movie *, const char *);
+void movie_write(struct movie *, unsigned int, unsigned int, unsigned int);
+void movie_close(struct movie *);
+#endif
@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "pace.h"
+#include "ring.h"
+#include "apu.h"
+
+/* One Game Boy frame, 59.73Hz */
+#define FRAME_NS (70224 * 1e9 / 4194304)
+
+/* Sleeps can overrun by this much, the rest of the wait is spun */
+#define SPIN_NS 1e6
+
+/* Queued audio to keep, 40ms of stereo samples */
+#define AUDIO_TARGET (APU_RATE / 25 * 2)
+
+/* Frame times are reported this often */
+#define REPORT_FRAMES 1000
+
+static int mode;
+static struct ring *audio;
+static double deadline, last;
+
+/* Since the last report */
+static unsigned int frames;
+static double total, total_sq, worst;
+
+static double pace_now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void pace_sleep(double ns)
+{
+	struct timespec s;
+
+	s.tv_sec = ns / 1e9;
+	s.tv_nsec = ns - s.tv_sec * 1e9;
+	nanosleep(&s, NULL);
+}
+
+static void pace_sleep_until(double t)
+{
+	double now;
+
+	while((now = pace_now()) < t - SPIN_NS)
+		pace_sleep(t - SPIN_NS - now);
+
+	while(pace_now() < t)
+		;
+}
+
+void pace_init(int m, struct ring *a)
+{
+	mode = m;
+	audio = a;
+	if(mode == PACE_AUDIO && !audio)
+		mode = PACE_TIMER;
+
+	deadline = last = pace_now();
+}
+
+/* Frame time mean, deviation and worst miss against a real frame */
+static void pace_measure(void)
+{
+	double now = pace_now(), t = now - last, mean;
+
+	last = now;
+	frames++;
+	total += t;
+	total_sq += t * t;
+	if(fabs(t - FRAME_NS) > worst)
+		worst = fabs(t - FRAME_NS);
+
+	/* No vsync from the driver, SDL_Flip() hasn't waited at all */
+	if(mode == PACE_VSYNC && frames == 60 && total / frames < FRAME_NS / 2)
+	{
+		printf("No vsync, pacing with a timer\n");
+		mode = PACE_TIMER;
+		deadline = now;
+	}
+
+	if(frames < REPORT_FRAMES || mode == PACE_NONE)
+		return;
+
+	mean = total / frames;
+	printf("%.2f fps, frame time %.2f ms, jitter %.2f ms, worst %.2f ms\n",
+		1e9 / mean, mean / 1e6, sqrt(total_sq / frames - mean * mean) / 1e6, worst / 1e6);
+
+	frames = 0;
+	total = total_sq = worst = 0;
+}
+
+/* Wait for the next frame to be due, once the last one is shown */
+void pace_frame(void)
+{
+	unsigned int queued;
+
+	switch(mode)
+	{
+		case PACE_TIMER:
+			/* Far behind, start again from now rather than rushing */
+			deadline += FRAME_NS;
+			if(pace_now() > deadline + 4 * FRAME_NS)
+				deadline = pace_now();
+			else
+				pace_sleep_until(deadline);
+		break;
+		case PACE_AUDIO:
+			/* The audio thread takes whole buffers, no point spinning */
+			while((queued = ring_count(audio)) > AUDIO_TARGET)
+				pace_sleep((queued - AUDIO_TARGET) / 2 * 1e9 / APU_RATE);
+		break;
+	}
+
+	pace_measure();
+}
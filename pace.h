@@ -0,0 +1,14 @@
+#ifndef PACE_H
+#define PACE_H
+/* What decides when the next frame starts */
+enum {
+	PACE_NONE,	/* As fast as it goes */
+	PACE_TIMER,	/* A deadline every 70224 cycles of real time */
+	PACE_VSYNC,	/* The display, through SDL_Flip() blocking */
+	PACE_AUDIO	/* Keeping the audio ring at a set fill */
+};
+
+struct ring;
+void pace_init(int, struct ring *);
+void pace_frame(void);
+#endif
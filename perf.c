@@ -0,0 +1,73 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <time.h>
+#include "perf.h"
+
+/* Wall clock accounting for --bench. Everything is a no-op until
+ * perf_enable() so normal runs don't pay for the clock reads.
+ */
+static int enabled;
+static struct timespec run_start, part_start;
+static double part_ns[PERF_APU + 1];
+
+static const char *part_names[PERF_APU + 1] = {
+	[EVENT_LCD] = "lcd",
+	[EVENT_TIMER] = "timer",
+	[EVENT_DMA] = "dma",
+	[EVENT_RTC] = "rtc",
+	[EVENT_SERIAL] = "serial",
+	[PERF_CPU] = "cpu",
+	[PERF_APU] = "apu"
+};
+
+static double perf_ns(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+void perf_enable(void)
+{
+	enabled = 1;
+	clock_gettime(CLOCK_MONOTONIC, &run_start);
+}
+
+void perf_begin(int part)
+{
+	(void) part;
+
+	if(enabled)
+		clock_gettime(CLOCK_MONOTONIC, &part_start);
+}
+
+void perf_end(int part)
+{
+	struct timespec t;
+
+	if(!enabled)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	part_ns[part] += perf_ns(&part_start, &t);
+}
+
+void perf_report(const char *name, unsigned int frames, unsigned int instructions)
+{
+	struct timespec t;
+	double ns;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	ns = perf_ns(&run_start, &t);
+
+	if(!frames)
+		frames = 1;
+
+	printf("%s: %u frames in %.3f s, %.1f fps, %.1f MIPS (%.1f in the cpu)\n",
+		name, frames, ns / 1e9, frames / ns * 1e9,
+		instructions / ns * 1e3, instructions / part_ns[PERF_CPU] * 1e3);
+
+	printf("\tns/frame:");
+	for(i = 0; i <= PERF_APU; i++)
+		printf(" %s %.0f,", part_names[i], part_ns[i] / frames);
+	printf(" total %.0f\n", ns / frames);
+}
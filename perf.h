@@ -0,0 +1,15 @@
+#ifndef PERF_H
+#define PERF_H
+#include "sched.h"
+
+/* Time is split between the cpu, each kind of scheduler event and the
+ * APU catching up at the end of each frame
+ */
+#define PERF_CPU EVENT_MAX
+#define PERF_APU (EVENT_MAX + 1)
+
+void perf_enable(void);
+void perf_begin(int);
+void perf_end(int);
+void perf_report(const char *, unsigned int, unsigned int);
+#endif
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+
+/* The indices run freely and wrap, head - tail is what's queued */
+int ring_init(struct ring *r, unsigned int size)
+{
+	r->buf = malloc(size * sizeof *r->buf);
+	r->size = size;
+	r->head = 0;
+	r->tail = 0;
+
+	return r->buf != NULL;
+}
+
+void ring_free(struct ring *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+/* Copy n samples starting at index 'at', wrapping at the end */
+static void ring_copy(short *dst, const short *src, unsigned int n, unsigned int size, unsigned int at, int in)
+{
+	unsigned int first = size - at < n ? size - at : n;
+
+	if(in)
+	{
+		memcpy(&dst[at], src, first * sizeof *src);
+		memcpy(dst, &src[first], (n - first) * sizeof *src);
+	}
+	else
+	{
+		memcpy(dst, &src[at], first * sizeof *src);
+		memcpy(&dst[first], src, (n - first) * sizeof *src);
+	}
+}
+
+/* Producer side, returns how many samples fitted */
+unsigned int ring_write(struct ring *r, const short *s, unsigned int n)
+{
+	unsigned int head = r->head;
+	unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	if(n > r->size - (head - tail))
+		n = r->size - (head - tail);
+
+	ring_copy(r->buf, s, n, r->size, head & (r->size - 1), 1);
+	__atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+/* Consumer side, returns how many samples there were */
+unsigned int ring_read(struct ring *r, short *s, unsigned int n)
+{
+	unsigned int tail = r->tail;
+	unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	if(n > head - tail)
+		n = head - tail;
+
+	ring_copy(s, r->buf, n, r->size, tail & (r->size - 1), 0);
+	__atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+/* Samples queued, from either side */
+unsigned int ring_count(struct ring *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
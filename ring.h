@@ -0,0 +1,20 @@
+#ifndef RING_H
+#define RING_H
+
+/* Single producer, single consumer queue of samples. Each side only
+ * writes its own index, so neither ever waits for the other: a full ring
+ * drops what doesn't fit, an empty one returns less than asked for.
+ */
+struct ring {
+	short *buf;
+	unsigned int size;	/* A power of two */
+	unsigned int head;	/* Next write, only the producer moves it */
+	unsigned int tail;	/* Next read, only the consumer moves it */
+};
+
+int ring_init(struct ring *, unsigned int);
+void ring_free(struct ring *);
+unsigned int ring_write(struct ring *, const short *, unsigned int);
+unsigned int ring_read(struct ring *, short *, unsigned int);
+unsigned int ring_count(struct ring *);
+#endif
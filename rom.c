@@ -4,13 +4,14 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 #endif
 #include <stdio.h>
 #include <string.h>
 #include "rom.h"
+#include "gb.h"
 
-unsigned char *bytes;
-unsigned int mapper;
+#define rom (gb_current->rom)
 
 static char *carts[] = {
 	[0x00] = "ROM ONLY",
@@ -53,6 +54,7 @@ static char *banks[] = {
 	"  1MiB",
 	"  2MiB",
 	"  4MiB",
+	"  8MiB",
 	/* 0x52 */
 	"1.1MiB",
 	"1.2MiB",
@@ -65,9 +67,15 @@ static char *rams[] = {
 	"  2KiB",
 	"  8KiB",
 	" 32KiB",
+	"128KiB",
+	" 64KiB",
 	"Unknown"
 };
 
+static unsigned int ram_sizes[] = {
+	0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000, 0
+};
+
 static char *regions[] = {
 	"Japan",
 	"Non-Japan",
@@ -83,88 +91,136 @@ static unsigned char header[] = {
 	0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E
 };
 
-static int rom_init(unsigned char *rombytes)
+/* Check the header and pick the mapper, describing the ROM if 'verbose' */
+static int rom_init(unsigned char *rombytes, unsigned int size, int verbose)
 {
 	char buf[17];
 	int type, bank_index, ram, region, version, i, pass;
 	unsigned char checksum = 0;
 
+	if(size < 0x150)
+		return 0;
+
 	if(memcmp(&rombytes[0x104], header, sizeof(header)) != 0)
 		return 0;
 
 	memcpy(buf, &rombytes[0x134], 16);
 	buf[16] = '\0';
-	printf("Rom title: %s\n", buf);
+	if(verbose)
+		printf("Rom title: %s\n", buf);
 
 	type = rombytes[0x147];
 
-	printf("Cartridge type: %s (%02X)\n", carts[type], type);
+	if(verbose)
+		printf("Cartridge type: %s (%02X)\n", carts[type], type);
 
 	bank_index = rombytes[0x148];
 	/* Adjust for the gap in the bank indicies */
 	if(bank_index >= 0x52 && bank_index <= 0x54)
-		bank_index -= 74;
-	else if(bank_index > 7)
-		bank_index = 11;
+		bank_index -= 73;
+	else if(bank_index > 8)
+		bank_index = 12;
 
-	printf("Rom size: %s\n", banks[bank_index]);
+	if(verbose)
+		printf("Rom size: %s\n", banks[bank_index]);
 
 	ram = rombytes[0x149];
-	if(ram > 3)
-		ram = 4;
+	if(ram > 5)
+		ram = 6;
 
-	printf("RAM size: %s\n", rams[ram]);
+	if(verbose)
+		printf("RAM size: %s\n", rams[ram]);
 
 	region = rombytes[0x14A];
 	if(region > 2)
 		region = 2;
-	printf("Region: %s\n", regions[region]);
+	if(verbose)
+		printf("Region: %s\n", regions[region]);
 
 	version = rombytes[0x14C];
-	printf("Version: %02X\n", version);
+	if(verbose)
+		printf("Version: %02X\n", version);
 
 	for(i = 0x134; i <= 0x14C; i++)
 		checksum = checksum - rombytes[i] - 1;
 
 	pass = rombytes[0x14D] == checksum;
 
-	printf("Checksum: %s (%02X)\n", pass ? "OK" : "FAIL", checksum);
+	if(verbose)
+		printf("Checksum: %s (%02X)\n", pass ? "OK" : "FAIL", checksum);
 	if(!pass)
 		return 0;
 
-	bytes = rombytes;
+	rom.bytes = rombytes;
+	rom.ram_size = ram_sizes[ram];
+
+	/* 32KiB doubled per step, the odd sizes are 72, 80 and 96 banks */
+	if(bank_index < 9)
+		rom.banks = 2 << bank_index;
+	else if(bank_index < 12)
+		rom.banks = bank_index == 9 ? 72 : bank_index == 10 ? 80 : 96;
+	else
+		rom.banks = 2;
+
+	/* A truncated file would have banks mapped past its end */
+	if(size < rom.banks * 0x4000)
+	{
+		if(verbose)
+			printf("File is only %u bytes, too short for its %u banks\n", size, rom.banks);
+		return 0;
+	}
+
+	switch(type)
+	{
+		case 0x03:
+		case 0x06:
+		case 0x09:
+		case 0x0D:
+		case 0x0F:
+		case 0x10:
+		case 0x13:
+		case 0x17:
+		case 0x1B:
+		case 0x1E:
+		case 0xFF:
+			rom.battery = 1;
+		break;
+	}
+
+	rom.rtc = type == 0x0F || type == 0x10;
+	rom.rumble = type >= 0x1C && type <= 0x1E;
 
 	switch(type)
 	{
 		case 0x00:
 		case 0x08:
 		case 0x09:
-			mapper = NROM;
+			rom.mapper = NROM;
 		break;
 		case 0x01:
 		case 0x02:
 		case 0x03:
-			mapper = MBC1;
+			rom.mapper = MBC1;
 		break;
 		case 0x05:
 		case 0x06:
-			mapper = MBC2;
+			rom.mapper = MBC2;
 		break;
 		case 0x0B:
 		case 0x0C:
-			mapper = MMM01;
+			rom.mapper = MMM01;
 		break;
 		case 0x0F:
 		case 0x10:
 		case 0x11:
 		case 0x12:
 		case 0x13:
-			mapper = MBC3;
+			rom.mapper = MBC3;
 		break;
 		case 0x15:
 		case 0x16:
 		case 0x17:
-			mapper = MBC4;
+			rom.mapper = MBC4;
 		break;
 		case 0x19:
 		case 0x1A:
@@ -172,7 +228,7 @@ static int rom_init(unsigned char *rombytes)
 		case 0x1C:
 		case 0x1D:
 		case 0x1E:
-			mapper = MBC5;
+			rom.mapper = MBC5;
 		break;
 	}
 
@@ -181,10 +237,36 @@ static int rom_init(unsigned char *rombytes)
 
 unsigned int rom_get_mapper(void)
 {
-	return mapper;
+	return rom.mapper;
 }
 
-int rom_load(const char *filename)
+unsigned int rom_get_banks(void)
+{
+	return rom.banks;
+}
+
+unsigned int rom_get_ram_size(void)
+{
+	return rom.ram_size;
+}
+
+int rom_has_battery(void)
+{
+	return rom.battery;
+}
+
+int rom_has_rtc(void)
+{
+	return rom.rtc;
+}
+
+int rom_has_rumble(void)
+{
+	return rom.rumble;
+}
+
+/* Map a ROM file read-only, it can be shared by any number of instances */
+unsigned char *rom_map(const char *filename, unsigned int *size)
 {
 #ifdef _WIN32
 	HANDLE f, map;
@@ -200,30 +282,77 @@ int rom_load(const char *filename)
 		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 
 	if(f == INVALID_HANDLE_VALUE)
-		return 0;
+		return NULL;
 
+	/* The view keeps the file open, the handles aren't needed after it */
 	map = CreateFileMapping(f, NULL, PAGE_READONLY, 0, 0, NULL);
-	if(!map)
-		return 0;
-
-	bytes = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
-	if(!bytes)
-		return 0;
+	bytes = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : NULL;
+	*size = GetFileSize(f, NULL);
+	if(map)
+		CloseHandle(map);
+	CloseHandle(f);
 #else
 	f = open(filename, O_RDONLY);
 	if(f == -1)
-		return 0;
+		return NULL;
 	if(fstat(f, &st) == -1)
-		return 0;
+	{
+		close(f);
+		return NULL;
+	}
 
+	/* The mapping keeps the file open, the descriptor isn't needed after it */
 	bytes = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, f, 0);
+	close(f);
+	if(bytes == MAP_FAILED)
+		return NULL;
+	*size = st.st_size;
+#endif
+	return bytes;
+}
+
+void rom_unmap(unsigned char *bytes, unsigned int size)
+{
+#ifdef _WIN32
+	(void) size;
+	UnmapViewOfFile(bytes);
+#else
+	munmap(bytes, size);
+#endif
+}
+
+int rom_load(const char *filename)
+{
+	unsigned int size;
+	unsigned char *bytes = rom_map(filename, &size);
+
 	if(!bytes)
 		return 0;
-#endif
-	return rom_init(bytes);
+
+	if(!rom_init(bytes, size, 1))
+	{
+		rom_unmap(bytes, size);
+		return 0;
+	}
+
+	rom.size = size;
+
+	return 1;
+}
+
+/* Use a ROM someone else mapped, it's left alone on unload */
+int rom_attach(unsigned char *bytes, unsigned int size)
+{
+	return rom_init(bytes, size, 0);
+}
+
+void rom_unload(void)
+{
+	if(rom.size)
+		rom_unmap(rom.bytes, rom.size);
 }
 
 unsigned char *rom_getbytes(void)
 {
-	return bytes;
+	return rom.bytes;
 }
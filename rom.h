@@ -1,8 +1,17 @@
 #ifndef ROM_H
 #define ROM_H
+unsigned char *rom_map(const char *, unsigned int *);
+void rom_unmap(unsigned char *, unsigned int);
 int rom_load(const char *);
+int rom_attach(unsigned char *, unsigned int);
+void rom_unload(void);
 unsigned char *rom_getbytes(void);
 unsigned int rom_get_mapper(void);
+unsigned int rom_get_banks(void);
+unsigned int rom_get_ram_size(void);
+int rom_has_battery(void);
+int rom_has_rtc(void);
+int rom_has_rumble(void);
 
 enum {
 	NROM,
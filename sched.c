@@ -0,0 +1,103 @@
+#include "sched.h"
+#include "cpu.h"
+#include "lcd.h"
+#include "timer.h"
+#include "mem.h"
+#include "mbc.h"
+#include "serial.h"
+#include "state.h"
+#include "perf.h"
+#include "gb.h"
+
+/* Timestamps are in cpu cycles. An event at time t is due once the cpu
+ * has run past t, that is before the first instruction starting after t.
+ */
+#define sched (gb_current->sched)
+
+/* Compare timestamps so that the cycle counter is free to wrap */
+#define BEFORE(a, b) ((int)((a) - (b)) < 0)
+
+static void sched_update(void)
+{
+	int i;
+
+	/* Far enough ahead to never be reached, near enough that events the
+	 * cpu has already run past still compare as before it.
+	 */
+	sched.next_event = cpu_get_cycles() + 0x3FFFFFFF;
+
+	for(i = 0; i < EVENT_MAX; i++)
+		if(sched.pending[i] && BEFORE(sched.when[i], sched.next_event))
+			sched.next_event = sched.when[i];
+}
+
+void sched_add(int event, unsigned int t)
+{
+	sched.when[event] = t;
+	sched.pending[event] = 1;
+	sched_update();
+}
+
+void sched_cancel(int event)
+{
+	sched.pending[event] = 0;
+	sched_update();
+}
+
+unsigned int sched_next(void)
+{
+	return sched.next_event;
+}
+
+static void sched_dispatch(int event, unsigned int t)
+{
+	switch(event)
+	{
+		case EVENT_LCD:
+			lcd_event(t);
+		break;
+		case EVENT_TIMER:
+			timer_event(t);
+		break;
+		case EVENT_DMA:
+			mem_dma_end();
+		break;
+		case EVENT_RTC:
+			mbc_rtc_event(t);
+		break;
+		case EVENT_SERIAL:
+			serial_event(t);
+		break;
+	}
+}
+
+void sched_state(struct state *s)
+{
+	STATE_VAR(s, sched.when);
+	STATE_VAR(s, sched.pending);
+
+	if(s->loading)
+		sched_update();
+}
+
+/* Run every event the cpu has gone past, earliest first */
+void sched_run(void)
+{
+	unsigned int now = cpu_get_cycles();
+
+	while(BEFORE(sched.next_event, now))
+	{
+		int i, event = 0;
+
+		for(i = 0; i < EVENT_MAX; i++)
+			if(sched.pending[i] && sched.when[i] == sched.next_event)
+				event = i;
+
+		sched.pending[event] = 0;
+		perf_begin(event);
+		sched_dispatch(event, sched.next_event);
+		perf_end(event);
+
+		sched_update();
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef SCHED_H
+#define SCHED_H
+void sched_add(int, unsigned int);
+void sched_cancel(int);
+unsigned int sched_next(void);
+void sched_run(void);
+struct state;
+void sched_state(struct state *);
+
+enum {
+	EVENT_LCD,	/* Next PPU mode or line change, vblank ends the frame */
+	EVENT_TIMER,	/* Next TIMA overflow */
+	EVENT_DMA,	/* End of OAM DMA */
+	EVENT_RTC,	/* MBC3 clock ticks a second */
+	EVENT_SERIAL,	/* Link port byte sent */
+	EVENT_MAX
+};
+#endif
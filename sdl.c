@@ -1,24 +1,79 @@
 #include <SDL/SDL.h>
-#include <sys/time.h>
-#include <windows.h>
 #include <stdio.h>
+#include "ring.h"
+#include "apu.h"
 static SDL_Surface *screen;
+static struct ring audio;
+static int audio_open;
+static short audio_last[2];
 static unsigned int frames;
-static struct timeval tv1, tv2;
+static int headless;
 
 static int button_start, button_select, button_a, button_b, button_down, button_up, button_left, button_right;
 
-void sdl_init(void)
+/* Runs on SDL's audio thread, never waits for the emulator. Running dry
+ * holds the last sample rather than clicking to zero.
+ */
+static void sdl_audio(void *data, Uint8 *stream, int len)
 {
-	SDL_Init(SDL_INIT_VIDEO);
+	short *out = (short *)stream;
+	unsigned int n = len / sizeof *out, got, i;
+
+	(void) data;
+
+	got = ring_read(&audio, out, n);
+	if(got >= 2)
+	{
+		audio_last[0] = out[got - 2];
+		audio_last[1] = out[got - 1];
+	}
+
+	for(i = got; i < n; i++)
+		out[i] = audio_last[i & 1];
+}
+
+void sdl_init(int no_window)
+{
+	headless = no_window;
+
+	/* Render into a plain software surface, no window or event loop */
+	if(headless)
+	{
+		screen = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 32, 0, 0, 0, 0);
+		return;
+	}
+
+	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
 	screen = SDL_SetVideoMode(640, 480, 32, SDL_HWSURFACE | SDL_DOUBLEBUF);
 	SDL_WM_SetCaption("Fer is an ejit", NULL);
+
+	/* About a third of a second of stereo samples between us and SDL */
+	if(ring_init(&audio, 32768))
+	{
+		SDL_AudioSpec want;
+
+		want.freq = APU_RATE;
+		want.format = AUDIO_S16SYS;
+		want.channels = 2;
+		want.samples = 512;
+		want.callback = sdl_audio;
+		want.userdata = NULL;
+
+		audio_open = SDL_OpenAudio(&want, NULL) == 0;
+		if(audio_open)
+			SDL_PauseAudio(0);
+		else
+			printf("No audio: %s\n", SDL_GetError());
+	}
 }
 
 int sdl_update(void)
 {
 	SDL_Event e;
 
+	if(headless)
+		return 0;
+
 	while(SDL_PollEvent(&e))
 	{
 		if(e.type == SDL_QUIT)
@@ -110,22 +165,34 @@ unsigned int *sdl_get_framebuffer(void)
 	return screen->pixels;
 }
 
+struct ring *sdl_get_audio(void)
+{
+	return audio_open ? &audio : NULL;
+}
+
+unsigned int sdl_get_frames(void)
+{
+	return frames;
+}
+
+/* Show the frame, pace.c decides when the next one starts */
 void sdl_frame(void)
 {
-	if(frames == 0)
-		gettimeofday(&tv1, NULL);
-	
 	frames++;
-	if(frames % 1000 == 0)
-	{
-		gettimeofday(&tv2, NULL);
-		printf("Frames %d, seconds: %d, fps: %d\n", frames, tv2.tv_sec - tv1.tv_sec, frames/(tv2.tv_sec - tv1.tv_sec));
-	}
-	Sleep(16);
-	SDL_Flip(screen);
+
+	if(!headless)
+		SDL_Flip(screen);
 }
 
 void sdl_quit()
 {
+	if(headless)
+	{
+		SDL_FreeSurface(screen);
+		return;
+	}
+	if(audio_open)
+		SDL_CloseAudio();
+	ring_free(&audio);
 	SDL_Quit();
 }
\ No newline at end of file
@@ -1,10 +1,12 @@
 #ifndef SDL_H
 #define SDL_H
 int sdl_update(void);
-void sdl_init(void);
+void sdl_init(int);
 void sdl_frame(void);
 void sdl_quit(void);
 unsigned int *sdl_get_framebuffer(void);
 unsigned int sdl_get_buttons(void);
 unsigned int sdl_get_directions(void);
+unsigned int sdl_get_frames(void);
+struct ring *sdl_get_audio(void);
 #endif
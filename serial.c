@@ -0,0 +1,77 @@
+#include <string.h>
+#include "serial.h"
+#include "interrupt.h"
+#include "cpu.h"
+#include "sched.h"
+#include "state.h"
+#include "gb.h"
+
+/* Nothing is ever plugged into the link port. A transfer on the internal
+ * clock shifts our byte out at 8192Hz and 0xFF in, one on the external
+ * clock never finishes. Every byte sent is kept in the capture buffer.
+ */
+#define SERIAL_BYTE_CYCLES 4096
+
+#define serial (gb_current->serial)
+
+/* When full the oldest half goes, the end says how a test ROM did */
+static void serial_capture(unsigned char c)
+{
+	if(serial.captured == sizeof serial.capture)
+	{
+		serial.captured /= 2;
+		memmove(serial.capture, &serial.capture[serial.captured], serial.captured);
+	}
+
+	serial.capture[serial.captured++] = c;
+}
+
+unsigned char serial_get_data(void)
+{
+	return serial.data;
+}
+
+unsigned char serial_get_control(void)
+{
+	return serial.control | 0x7E;
+}
+
+void serial_write_data(unsigned char v)
+{
+	serial.data = v;
+}
+
+void serial_write_control(unsigned char v)
+{
+	serial.control = v & 0x81;
+
+	if((v & 0x81) == 0x81)
+		sched_add(EVENT_SERIAL, cpu_get_cycles() + SERIAL_BYTE_CYCLES);
+	else
+		sched_cancel(EVENT_SERIAL);
+}
+
+/* The transfer started at t - SERIAL_BYTE_CYCLES is done */
+void serial_event(unsigned int t)
+{
+	(void) t;
+
+	serial_capture(serial.data);
+	serial.data = 0xFF;
+	serial.control &= 0x7F;
+	interrupt(INTR_SERIAL);
+}
+
+/* The capture is output, not state, loading leaves it alone */
+void serial_state(struct state *s)
+{
+	STATE_VAR(s, serial.data);
+	STATE_VAR(s, serial.control);
+}
+
+void serial_init(void)
+{
+	serial.data = 0;
+	serial.control = 0;
+	serial.captured = 0;
+}
@@ -0,0 +1,11 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+void serial_init(void);
+void serial_event(unsigned int);
+unsigned char serial_get_data(void);
+unsigned char serial_get_control(void);
+void serial_write_data(unsigned char);
+void serial_write_control(unsigned char);
+struct state;
+void serial_state(struct state *);
+#endif
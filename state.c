@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "state.h"
+#include "cpu.h"
+#include "mem.h"
+#include "mbc.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "serial.h"
+#include "apu.h"
+#include "lcd.h"
+#include "sched.h"
+
+/* A save state is one flat block: a small header followed by each
+ * module's variables, copied as they are in memory. Saving and loading
+ * are just a run of memcpys, so a state can be taken and restored many
+ * times over from the same buffer. The layout is native, states aren't
+ * meant to move between builds or machines.
+ */
+struct state_header {
+	char magic[4];
+	unsigned int version;
+	unsigned int size;
+	unsigned char rom_checksum[2];
+};
+
+void state_var(struct state *s, void *p, unsigned int n)
+{
+	if(s->loading)
+		memcpy(p, s->buf + s->len, n);
+	else if(s->buf)
+		memcpy(s->buf + s->len, p, n);
+
+	s->len += n;
+}
+
+/* The order matters on load, the scheduler works from the cpu's clock */
+static void state_modules(struct state *s)
+{
+	cpu_state(s);
+	mem_state(s);
+	mbc_state(s);
+	interrupt_state(s);
+	timer_state(s);
+	serial_state(s);
+	apu_state(s);
+	lcd_state(s);
+	sched_state(s);
+}
+
+static void state_make_header(gb_t *gb, struct state_header *h)
+{
+	memset(h, 0, sizeof *h);
+	memcpy(h->magic, "GBSS", 4);
+	h->version = STATE_VERSION;
+	h->size = state_size(gb);
+	h->rom_checksum[0] = gb->rom.bytes[0x14E];
+	h->rom_checksum[1] = gb->rom.bytes[0x14F];
+}
+
+unsigned int state_size(gb_t *gb)
+{
+	struct state s = {NULL, sizeof (struct state_header), 0};
+	gb_t *prev = gb_select(gb);
+
+	state_modules(&s);
+	gb_select(prev);
+
+	return s.len;
+}
+
+/* buf must hold state_size() bytes */
+unsigned int state_save(gb_t *gb, unsigned char *buf)
+{
+	struct state_header h;
+	struct state s = {buf, sizeof h, 0};
+	gb_t *prev;
+
+	state_make_header(gb, &h);
+	memcpy(buf, &h, sizeof h);
+
+	prev = gb_select(gb);
+	state_modules(&s);
+	gb_select(prev);
+
+	return s.len;
+}
+
+int state_load(gb_t *gb, const unsigned char *buf, unsigned int len)
+{
+	struct state_header h;
+	struct state s = {(unsigned char *)buf, sizeof (struct state_header), 1};
+	gb_t *prev;
+
+	state_make_header(gb, &h);
+
+	if(len != h.size || memcmp(buf, &h, sizeof h))
+	{
+		fprintf(stderr, "Save state doesn't match this ROM or version\n");
+		return 0;
+	}
+
+	prev = gb_select(gb);
+	state_modules(&s);
+	gb_select(prev);
+
+	return 1;
+}
+
+int state_save_file(gb_t *gb, const char *filename)
+{
+	unsigned int len = state_size(gb);
+	unsigned char *buf = malloc(len);
+	FILE *f;
+	int r = 0;
+
+	f = fopen(filename, "wb");
+	if(f)
+	{
+		state_save(gb, buf);
+		r = fwrite(buf, 1, len, f) == len;
+		fclose(f);
+	}
+
+	free(buf);
+
+	return r;
+}
+
+int state_load_file(gb_t *gb, const char *filename)
+{
+	unsigned int len = state_size(gb);
+	unsigned char *buf = malloc(len);
+	FILE *f;
+	int r = 0;
+
+	f = fopen(filename, "rb");
+	if(f)
+	{
+		r = fread(buf, 1, len, f) == len && fgetc(f) == EOF && state_load(gb, buf, len);
+		fclose(f);
+	}
+
+	free(buf);
+
+	return r;
+}
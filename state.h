@@ -0,0 +1,22 @@
+#ifndef STATE_H
+#define STATE_H
+#include "gb.h"
+
+/* Bump whenever a module adds, drops or reorders what it saves */
+#define STATE_VERSION 6
+
+struct state {
+	unsigned char *buf;	/* NULL just works out the size */
+	unsigned int len;
+	int loading;
+};
+
+void state_var(struct state *, void *, unsigned int);
+#define STATE_VAR(s, x) state_var(s, &(x), sizeof (x))
+
+unsigned int state_size(gb_t *);
+unsigned int state_save(gb_t *, unsigned char *);
+int state_load(gb_t *, const unsigned char *, unsigned int);
+int state_save_file(gb_t *, const char *);
+int state_load_file(gb_t *, const char *);
+#endif
@@ -1,100 +1,170 @@
 #include "timer.h"
 #include "interrupt.h"
 #include "cpu.h"
+#include "sched.h"
+#include "state.h"
+#include "gb.h"
 
-static unsigned int prev_time;
-static unsigned int elapsed;
-static unsigned int ticks;
+/* Longest the timer is left unsynced when the counter won't overflow */
+#define TIMER_IDLE 0x10000
 
-static unsigned char tac;
-static unsigned int started;
-static unsigned int speed;
-static unsigned int counter;
-static unsigned int divider;
-static unsigned int modulo;
+#define timer (gb_current->timer)
+
+static void timer_sync(void);
+static void timer_schedule(void);
 
 void timer_set_div(unsigned char v)
 {
 	(void) v;
-	divider = 0;
+	timer_sync();
+	timer.divider = 0;
 }
 
 unsigned char timer_get_div(void)
 {
-	return divider;
+	timer_sync();
+	return timer.divider;
 }
 
 void timer_set_counter(unsigned char v)
 {
-	counter = v;
+	timer_sync();
+	timer.counter = v;
+	timer_schedule();
 }
 
 unsigned char timer_get_counter(void)
 {
-	return counter;
+	timer_sync();
+	return timer.counter;
 }
 
 void timer_set_modulo(unsigned char v)
 {
-	modulo = v;
+	timer_sync();
+	timer.modulo = v;
 }
 
 unsigned char timer_get_modulo(void)
 {
-	return modulo;
+	return timer.modulo;
 }
 
 void timer_set_tac(unsigned char v)
 {
 	int speeds[] = {64, 1, 4, 16};
-	tac = v;
-	started = v&4;
-	speed = speeds[v&3];
+	timer_sync();
+	timer.tac = v;
+	timer.started = v&4;
+	timer.speed = speeds[v&3];
+	timer_schedule();
 }
 
 unsigned char timer_get_tac(void)
 {
-	return tac;
+	return timer.tac;
 }
 
 static void timer_tick(void)
 {
 	/* 1/262144Hz has elapsed */
-	ticks++;
+	timer.ticks++;
 
 	/* Divider updates at 16384Hz */
-	if(ticks == 16)
-	{
-		divider++;
-		ticks = 0;
+	if(timer.ticks == 16)
+	{
+		timer.divider++;
+		timer.ticks = 0;
 	}
 
-	if(!started)
+	if(!timer.started)
 		return;
 
-	if(ticks == speed)
+	if(timer.ticks == timer.speed)
 	{
-		counter++;
-		ticks = 0;
+		timer.counter++;
+		timer.ticks = 0;
 	}
 
-	if(counter == 0x100)
+	if(timer.counter == 0x100)
 	{
 		interrupt(INTR_TIMER);
-		counter = modulo;
+		timer.counter = timer.modulo;
 	}
 }
 
-void timer_cycle(void)
+/* Run all the ticks for cycles before 'now' */
+static void timer_run(unsigned int now)
 {
-	/* The amount of ticks since we last ran */
-	unsigned int delta = cpu_get_cycles() - prev_time;
-	prev_time = cpu_get_cycles();
+	timer.elapsed += (now - timer.time) * 4; /* 4 cycles to a timer tick */
+	timer.time = now;
 
-	elapsed += delta * 4; /* 4 cycles to a timer tick */
-	if(elapsed >= 16)
+	while(timer.elapsed >= 16)
 	{
 		timer_tick();
-		elapsed -= 16;	/* keep track of the time overflow */
+		timer.elapsed -= 16;	/* keep track of the time overflow */
+	}
+}
+
+static void timer_sync(void)
+{
+	timer_run(cpu_get_cycles());
+}
+
+/* Cycles from timer_time until the tick that overflows the counter,
+ * found by running timer_tick()'s logic on a copy of the state.
+ */
+static unsigned int timer_next_overflow(void)
+{
+	unsigned int t = timer.ticks, n = timer.counter, cycles;
+
+	if(!timer.started || timer.speed >= 16)
+		return TIMER_IDLE;
+
+	for(cycles = (16 - timer.elapsed)/4 - 1; cycles < TIMER_IDLE; cycles += 4)
+	{
+		if(++t == 16)
+			t = 0;
+
+		if(t == timer.speed)
+		{
+			n++;
+			t = 0;
+		}
+
+		if(n == 0x100)
+			return cycles;
 	}
-}
+
+	return TIMER_IDLE;
+}
+
+static void timer_schedule(void)
+{
+	sched_add(EVENT_TIMER, timer.time + timer_next_overflow());
+}
+
+void timer_init(void)
+{
+	timer_schedule();
+}
+
+void timer_state(struct state *s)
+{
+	STATE_VAR(s, timer.time);
+	STATE_VAR(s, timer.elapsed);
+	STATE_VAR(s, timer.ticks);
+	STATE_VAR(s, timer.tac);
+	STATE_VAR(s, timer.started);
+	STATE_VAR(s, timer.speed);
+	STATE_VAR(s, timer.counter);
+	STATE_VAR(s, timer.divider);
+	STATE_VAR(s, timer.modulo);
+}
+
+/* Run up to and including the cycle at 't' */
+void timer_event(unsigned int t)
+{
+	timer_run(t + 1);
+	timer_schedule();
+}
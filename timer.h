@@ -1,7 +1,8 @@
 #ifndef TIMER_H
 #define TIMER_H
 void timer_set_tac(unsigned char);
-void timer_cycle(void);
+void timer_init(void);
+void timer_event(unsigned int);
 unsigned char timer_get_div(void);
 unsigned char timer_get_counter(void);
 unsigned char timer_get_modulo(void);
@@ -9,4 +10,6 @@ unsigned char timer_get_tac(void);
 void timer_set_div(unsigned char);
 void timer_set_counter(unsigned char);
 void timer_set_modulo(unsigned char);
+struct state;
+void timer_state(struct state *);
 #endif
\ No newline at end of file